@@ -0,0 +1,102 @@
+/***
+Writes the synthetic files and keystroke scripts used by `make bench`.
+Usage: gencorpus OUTDIR
+***/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define PAGE_UP_SEQ "\x1b[5~"
+#define PAGE_DOWN_SEQ "\x1b[6~"
+#define ARROW_DOWN_SEQ "\x1b[B"
+#define CTRL_KEY(k) ((k) & 0x1f)
+
+FILE *openOut(const char *dir, const char *name){
+	char path[4096];
+	snprintf(path, sizeof(path), "%s/%s", dir, name);
+	FILE *fp = fopen(path, "w");
+	if (!fp){
+		perror(path);
+		exit(1);
+	}
+	return fp;
+}
+
+//Lots of short lines that look like code, with the odd search target
+void genShortLines(const char *dir){
+	FILE *fp = openOut(dir, "short_lines.c");
+	for (int i = 0; i < 200000; i++){
+		if (i % 1000 == 0) fprintf(fp, "\t// needle %d\n", i);
+		else fprintf(fp, "\tint v%d = %d; /* c */\n", i, i * 7);
+	}
+	fclose(fp);
+}
+
+//A handful of lines where one of them is enormous (minified js, json dumps...)
+void genHugeLine(const char *dir){
+	FILE *fp = openOut(dir, "huge_line.c");
+	fprintf(fp, "int start;\n");
+	for (int i = 0; i < 400000; i++){
+		fprintf(fp, "\"k%d\": %d, ", i, i);
+		if (i % 50000 == 0) fprintf(fp, "needle, ");
+	}
+	fprintf(fp, "\nint end;\n");
+	fclose(fp);
+}
+
+//Comments opened and closed over and over, so every edit near the top has to
+//cascade the multiline comment state through the rest of the file
+void genNestedComments(const char *dir){
+	FILE *fp = openOut(dir, "nested_comments.c");
+	for (int i = 0; i < 100000; i++){
+		int depth = i % 16;
+		for (int d = 0; d < depth; d++) fputc('\t', fp);
+		if (i % 100 == 0) fprintf(fp, "/* needle {\n");
+		else if (i % 100 == 99) fprintf(fp, "} */ if (x) { y(\"/*\"); }\n");
+		else fprintf(fp, "{ /* %d */ while (a[%d]) { b(); }\n", i, i);
+	}
+	fclose(fp);
+}
+
+void repeat(FILE *fp, const char *keys, int times){
+	while (times--) fputs(keys, fp);
+}
+
+//The same session is replayed over every corpus, each kind of key is timed separately
+void genScript(const char *dir){
+	FILE *fp = openOut(dir, "session.keys");
+	char key[2] = {0, 0};
+
+	//scroll down a ways and back
+	repeat(fp, PAGE_DOWN_SEQ, 200);
+	repeat(fp, PAGE_UP_SEQ, 100);
+	repeat(fp, ARROW_DOWN_SEQ, 100);
+	//type, break lines and delete again
+	repeat(fp, "x", 300);
+	repeat(fp, "\r", 100);
+	key[0] = 127;
+	repeat(fp, key, 400);
+	//search and step through the matches
+	key[0] = CTRL_KEY('f');
+	repeat(fp, key, 1);
+	fputs("needle", fp);
+	repeat(fp, ARROW_DOWN_SEQ, 50);
+	repeat(fp, "\r", 1);
+	//and save a few times
+	key[0] = CTRL_KEY('s');
+	repeat(fp, key, 5);
+	fclose(fp);
+}
+
+int main(int argc, char *argv[]){
+	if (argc != 2){
+		fprintf(stderr, "usage: gencorpus OUTDIR\n");
+		return 1;
+	}
+	genShortLines(argv[1]);
+	genHugeLine(argv[1]);
+	genNestedComments(argv[1]);
+	genScript(argv[1]);
+	return 0;
+}
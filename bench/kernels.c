@@ -0,0 +1,266 @@
+/***
+Microbenchmarks for the row, highlight and output kernels in kilo.c.
+Usage: kernels [-o results.csv] [-c baseline.csv]
+
+Each kernel runs over a fixed set of inputs and reports ns/call, ns/byte and
+allocator calls per call. -o writes the numbers as csv, -c compares them
+against an earlier csv and exits non-zero if anything got slower by more
+than REGRESSION_PCT or started allocating more.
+***/
+
+#define KILO_NO_MAIN
+#include "../kilo.c"
+
+#define REPEATS 5
+#define REGRESSION_PCT 15.0
+#define MAX_RESULTS 64
+
+/*** ALLOCATION COUNTING ***/
+
+//the makefile links this with --wrap for each of these, so every allocation
+//made by kilo.c comes through here first
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t n, size_t size);
+void *__real_realloc(void *p, size_t size);
+
+unsigned long allocs = 0;
+
+void *__wrap_malloc(size_t size){
+	allocs++;
+	return __real_malloc(size);
+}
+
+void *__wrap_calloc(size_t n, size_t size){
+	allocs++;
+	return __real_calloc(n, size);
+}
+
+void *__wrap_realloc(void *p, size_t size){
+	allocs++;
+	return __real_realloc(p, size);
+}
+
+/*** INPUTS ***/
+
+struct input {
+	const char *name;
+	char *text;
+};
+
+struct input inputs[5];
+
+//a line of plausible C that's about len characters long
+char *makeLine(int len){
+	const char *piece = "if (x->n > 10) { y = f(\"s\", 4.2); } ";
+	int plen = strlen(piece);
+	char *s = malloc(len + 1);
+	for (int i = 0; i < len; i++) s[i] = piece[i % plen];
+	s[len] = '\0';
+	return s;
+}
+
+void setupInputs(){
+	inputs[0].name = "code";
+	inputs[0].text = strdup("\tif (x->count > 10) { return foo(bar, \"str\", 42); } // done");
+	inputs[1].name = "tabs";
+	inputs[1].text = strdup("\t\tcase\tKEY:\t\treturn\t1;\t\t/* tabbed */\t\t");
+	inputs[2].name = "comment";
+	inputs[2].text = strdup("/* a comment that goes on for a while, 1234 \"not a string\" */");
+	inputs[3].name = "long";
+	inputs[3].text = makeLine(4096);
+	inputs[4].name = "utf8";
+	inputs[4].text = strdup("\tlog(\"caf\xc3\xa9 \xe4\xb8\xad\xe6\x96\x87 \xf0\x9f\x98\x80\", n); // d\xc3\xa9j\xc3\xa0 vu");
+}
+
+#define NUM_INPUTS (int)(sizeof(inputs) / sizeof(inputs[0]))
+
+//Make E hold a single row containing text, highlighted as C
+void setupSingleRow(char *text){
+	E.syntax = &HLDB[0];
+	E.numrows = 0;
+	editorInsertRow(0, text, strlen(text));
+}
+
+void teardownRows(){
+	for (int j = 0; j < E.numrows; j++) editorFreeRow(&E.row[j]);
+	free(E.row);
+	E.row = NULL;
+	E.numrows = 0;
+}
+
+/*** RESULTS ***/
+
+struct result {
+	char kernel[32];
+	char input[32];
+	double bytes;
+	double ns_per_call;
+	double ns_per_byte;
+	double allocs_per_call;
+};
+
+struct result results[MAX_RESULTS];
+int numresults = 0;
+
+//Runs fn iters times, REPEATS rounds, and keeps the fastest round. Each run of
+//fn makes calls calls to the kernel, the numbers are reported per kernel call
+void measure(const char *kernel, const char *input, double bytes_per_call, int calls,
+	long iters, void (*fn)(void *), void *arg){
+	double best = -1;
+	unsigned long round_allocs = 0;
+	fn(arg);
+	for (int r = 0; r < REPEATS; r++){
+		unsigned long before = allocs;
+		unsigned long long start = nowNanos();
+		for (long i = 0; i < iters; i++) fn(arg);
+		double ns = (double)(nowNanos() - start) / iters / calls;
+		if (best < 0 || ns < best) best = ns;
+		round_allocs = allocs - before;
+	}
+	struct result *res = &results[numresults++];
+	snprintf(res->kernel, sizeof(res->kernel), "%s", kernel);
+	snprintf(res->input, sizeof(res->input), "%s", input);
+	res->bytes = bytes_per_call;
+	res->ns_per_call = best;
+	res->ns_per_byte = bytes_per_call > 0 ? best / bytes_per_call : 0;
+	res->allocs_per_call = (double)round_allocs / iters / calls;
+	printf("%-20s %-8s %10.0f %12.1f %10.3f %10.2f\n", res->kernel, res->input,
+		res->bytes, res->ns_per_call, res->ns_per_byte, res->allocs_per_call);
+}
+
+void writeResults(const char *path){
+	FILE *fp = fopen(path, "w");
+	if (!fp){
+		perror(path);
+		exit(1);
+	}
+	fprintf(fp, "kernel,input,bytes_per_call,ns_per_call,ns_per_byte,allocs_per_call\n");
+	for (int i = 0; i < numresults; i++){
+		struct result *r = &results[i];
+		fprintf(fp, "%s,%s,%.0f,%.2f,%.4f,%.3f\n", r->kernel, r->input,
+			r->bytes, r->ns_per_call, r->ns_per_byte, r->allocs_per_call);
+	}
+	fclose(fp);
+}
+
+//Returns the number of kernels that got worse compared to path
+int compareResults(const char *path){
+	FILE *fp = fopen(path, "r");
+	if (!fp){
+		perror(path);
+		exit(1);
+	}
+	char line[256];
+	int regressions = 0;
+	printf("\n%-20s %-8s %12s %12s %8s\n", "kernel", "input", "base ns/B", "ns/B", "change");
+	//skip the header
+	if (!fgets(line, sizeof(line), fp)) line[0] = '\0';
+	while (fgets(line, sizeof(line), fp)){
+		struct result base;
+		if (sscanf(line, "%31[^,],%31[^,],%lf,%lf,%lf,%lf", base.kernel, base.input,
+			&base.bytes, &base.ns_per_call, &base.ns_per_byte, &base.allocs_per_call) != 6) continue;
+		for (int i = 0; i < numresults; i++){
+			struct result *r = &results[i];
+			if (strcmp(r->kernel, base.kernel) || strcmp(r->input, base.input)) continue;
+			double change = base.ns_per_call > 0 ?
+				100.0 * (r->ns_per_call - base.ns_per_call) / base.ns_per_call : 0;
+			int worse = change > REGRESSION_PCT || r->allocs_per_call > base.allocs_per_call + 0.001;
+			printf("%-20s %-8s %12.3f %12.3f %+7.1f%%%s\n", r->kernel, r->input,
+				base.ns_per_byte, r->ns_per_byte, change, worse ? "  REGRESSION" : "");
+			regressions += worse;
+		}
+	}
+	fclose(fp);
+	return regressions;
+}
+
+/*** KERNELS ***/
+
+void runUpdateRow(void *arg){
+	(void)arg;
+	editorUpdateRow(&E.row[0]);
+}
+
+void runUpdateSyntax(void *arg){
+	(void)arg;
+	editorUpdateSyntax(&E.row[0]);
+}
+
+void runCxToRx(void *arg){
+	(void)arg;
+	editorRowCxToRx(&E.row[0], E.row[0].size + E.ln_length);
+}
+
+void runRowsToString(void *arg){
+	(void)arg;
+	int len;
+	free(editorRowsToString(&len));
+}
+
+//Appends the pieces of a typical frame: escapes, a line of text, line endings
+void runAbAppendFrame(void *arg){
+	char *line = arg;
+	struct abuf ab = ABUF_INIT;
+	abAppend(&ab, "\x1b[?25l", 6);
+	abAppend(&ab, "\x1b[H", 3);
+	for (int y = 0; y < 48; y++){
+		abAppend(&ab, "\x1b[33m", 5);
+		abAppend(&ab, line, 80);
+		abAppend(&ab, "\x1b[39m", 5);
+		abAppend(&ab, "\x1b[K", 3);
+		abAppend(&ab, "\r\n", 2);
+	}
+	abAppend(&ab, "\x1b[?25h", 6);
+	abFree(&ab);
+}
+
+#define ABAPPEND_FRAME_CALLS (2 + 48 * 5 + 1)
+#define ABAPPEND_FRAME_BYTES (6 + 3 + 48 * (5 + 80 + 5 + 3 + 2) + 6)
+
+int main(int argc, char *argv[]){
+	const char *out = NULL;
+	const char *baseline = NULL;
+	for (int i = 1; i < argc; i++){
+		if (!strcmp(argv[i], "-o") && i + 1 < argc) out = argv[++i];
+		else if (!strcmp(argv[i], "-c") && i + 1 < argc) baseline = argv[++i];
+		else{
+			fprintf(stderr, "usage: kernels [-o results.csv] [-c baseline.csv]\n");
+			return 1;
+		}
+	}
+
+	E.derived_budget = KILO_DERIVED_BUDGET;
+	E.ln_length = 2;
+	setupInputs();
+
+	printf("%-20s %-8s %10s %12s %10s %10s\n", "kernel", "input", "bytes", "ns/call", "ns/byte", "allocs");
+	for (int i = 0; i < NUM_INPUTS; i++){
+		setupSingleRow(inputs[i].text);
+		double bytes = E.row[0].size;
+		long iters = 2000000 / (E.row[0].size + 1);
+		measure("editorUpdateRow", inputs[i].name, bytes, 1, iters, runUpdateRow, NULL);
+		measure("editorUpdateSyntax", inputs[i].name, bytes, 1, iters, runUpdateSyntax, NULL);
+		measure("editorRowCxToRx", inputs[i].name, bytes, 1, iters * 4, runCxToRx, NULL);
+		teardownRows();
+	}
+
+	//a 10k line document made out of each input
+	for (int i = 0; i < NUM_INPUTS; i++){
+		E.syntax = &HLDB[0];
+		long len = strlen(inputs[i].text);
+		int rows = 10000;
+		for (int j = 0; j < rows; j++) editorInsertRow(E.numrows, inputs[i].text, len);
+		measure("editorRowsToString", inputs[i].name, (double)(len + 1) * rows, 1,
+			2000000 / (len + 1) / 100 + 1, runRowsToString, NULL);
+		teardownRows();
+	}
+
+	//abAppend is run a whole frame at a time
+	char *line = makeLine(80);
+	measure("abAppend", "frame", (double)ABAPPEND_FRAME_BYTES / ABAPPEND_FRAME_CALLS,
+		ABAPPEND_FRAME_CALLS, 2000, runAbAppendFrame, line);
+
+	if (out) writeResults(out);
+	if (baseline && compareResults(baseline) > 0) return 2;
+	return 0;
+}
@@ -0,0 +1,20 @@
+#!/bin/sh
+# Replays bench/out/session.keys over every generated corpus in headless mode
+# and prints the per-operation latency table for each one.
+set -e
+
+dir=bench/out
+mkdir -p $dir
+./bench/gencorpus $dir
+
+# open caches go in a scratch directory rather than ~/.cache, emptied first
+# so every run times the same uncached opens
+XDG_CACHE_HOME=$dir/cache
+export XDG_CACHE_HOME
+rm -rf $XDG_CACHE_HOME
+
+for corpus in short_lines huge_line nested_comments; do
+	echo "== $corpus"
+	./kilo --replay $dir/session.keys --size 50x200 $dir/$corpus.c
+	echo
+done
@@ -10,23 +10,82 @@ STUFF ABOUT THE PROGRAM GOES HERE
 #define _GNU_SOURCE
 
 #include <ctype.h>
+#include <dirent.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <limits.h>
+#include <poll.h>
+#include <signal.h>
 #include <stdio.h>
 #include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/inotify.h>
 #include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
 #include <sys/types.h>
+#include <sys/uio.h>
+#include <sys/wait.h>
 #include <termios.h>
 #include <time.h>
 #include <unistd.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
 /*** DEFINES ***/
 
 #define KILO_VERSION "0.0.1"
 #define KILO_TAB_STOP 4
 #define KILO_QUIT_TIMES 3
+//Biggest count Ctrl-U takes
+#define KILO_MAX_COUNT 1000000
+//Max bytes of render/hl kept around for rows that aren't on screen
+#define KILO_DERIVED_BUDGET (16 * 1024 * 1024)
+#define KILO_PERF_DUMP "kilo-perf.txt"
+//Pages the stats view can show
+#define STATS_GENERAL 1
+#define STATS_MEMORY 2
+//How much of a filter's output is read at a time, and how many iovecs its
+//input is written with
+#define KILO_FILTER_CHUNK (64 * 1024)
+#define KILO_FILTER_IOV 64
+//Rows per block in the block index, blocks are split once they get twice this big
+#define KILO_BLOCK_ROWS 1024
+//Follow mode: how often to check the file without an inotify event, the most
+//time one go at reading appended data can take before keys get a look in, and
+//the least time between redraws caused by appends
+#define KILO_FOLLOW_POLL_MS 250
+#define KILO_FOLLOW_SLICE_NS (4 * 1000 * 1000)
+#define KILO_FOLLOW_FRAME_MS 50
+//Words shorter or longer than this aren't offered for completion, and this
+//many of the most frequent matches are
+#define KILO_WORD_MIN 3
+#define KILO_WORD_MAX 64
+#define KILO_COMPLETE_MAX 8
+//Longest symbol name kept in the outline, and how many rows past the end of
+//a block its scan can look to see how a declaration ends
+#define KILO_SYMBOL_NAME 64
+#define KILO_SYMBOL_LOOKAHEAD 64
+//Most bytes of text kept for all the open buffers together, unmodified ones
+//that haven't been looked at for a while are let go to stay under it
+#define KILO_MEMORY_BUDGET (256 * 1024 * 1024)
+//Bytes to a row in the hex view, and how much of a file is looked at for a
+//NUL to decide it's binary and should be opened in it
+#define KILO_HEX_COLS 16
+#define KILO_HEX_SNIFF 8192
+//Files at least this big get an open cache, which is checked against this many
+//evenly spread samples of the file of this many bytes each (see OPEN CACHE).
+//The least recently used caches go once they add up to more than the max
+#define KILO_CACHE_MIN_BYTES (4 * 1024 * 1024)
+#define KILO_CACHE_MAX_BYTES (256L * 1024 * 1024)
+#define KILO_CACHE_SAMPLES 64
+#define KILO_CACHE_SAMPLE_BYTES 4096
+#define KILO_CACHE_MAGIC "kilohlc1"
 #define CTRL_KEY(k) ((k) & 0x1f)
 
 enum editorKey {
@@ -53,11 +112,49 @@ enum editorHighlight{
 	HL_MATCH
 };
 
+//What a keypress was for, latencies get recorded separately for each of these
+enum editorOp {
+	OP_OTHER = 0,
+	OP_OPEN,
+	OP_INSERT,
+	OP_NEWLINE,
+	OP_DELETE,
+	OP_FIND,
+	OP_SCROLL,
+	OP_SAVE,
+	OP_COUNT
+};
+
+//Where the time inside a frame goes. PH_KEY is the whole keypress
+//(handling + redraw), the rest are pieces of it and can overlap
+enum editorPhase {
+	PH_KEY = 0,
+	PH_INPUT,
+	PH_SYNTAX,
+	PH_DRAW,
+	PH_WRITE,
+	PH_FRAME,
+	PH_COUNT
+};
+
 #define HL_HIGHLIGHT_NUMBERS (1<<0)
 #define HL_HIGHLIGHT_STRINGS (1<<1)
+//the filetype has a symbol outline (C only, see OUTLINE)
+#define HL_OUTLINE (1<<2)
 
 /*** DATA ***/
 
+//Log-linear latency histogram in nanoseconds, 16 buckets per power of two
+#define LAT_SUB_BITS 4
+#define LAT_BUCKETS (64 << LAT_SUB_BITS)
+
+struct latency {
+	unsigned long count;
+	unsigned long long total;
+	unsigned long long max;
+	unsigned int buckets[LAT_BUCKETS];
+};
+
 struct editorSyntax {
 	char *filetype;
 	char **filematch;
@@ -68,16 +165,244 @@ struct editorSyntax {
 	int flags;
 };
 
+//A compressed format, known by the bytes its files start with, and the
+//commands that turn it back into text on stdout and text on stdin into it
+//magic is what the format's files start with, a '#' in it stands for a
+//digit from 1 to 9
+struct compressor {
+	char *name;
+	char *magic;
+	int magiclen;
+	char *suffix;
+	char *decompress;
+	char *compress;
+};
+
+#define ROW_OWNS_RENDER (1<<0)
+#define ROW_DERIVED (1<<1)
+#define ROW_REFERENCED (1<<2)
+#define ROW_ASCII (1<<3)
+//highlighting was skipped while a macro played, see editorHighlightStale
+#define ROW_STALE (1<<4)
+//the row's words are counted in the completion trie
+#define ROW_WORDS (1<<5)
+
+//One run of identically highlighted characters in a row's render
+typedef struct hlspan {
+	unsigned int len : 24;
+	unsigned int hl : 8;
+} hlspan;
+
+#define HLSPAN_MAX_LEN ((1 << 24) - 1)
+
+//Brackets left unmatched in a piece of text once the pairs inside it cancel
+//out, always some closes followed by some opens
+struct bracketsum {
+	int open;
+	int close;
+};
+
 typedef struct erow {
 	int idx;
 	int size;
 	int rsize;
 	char *chars;
+	//render points at chars unless the row has tabs (see ROW_OWNS_RENDER)
+	//render and hl are only valid while ROW_DERIVED is set, off-screen rows
+	//get them dropped (see editorTrimDerived) and rebuilt when needed
 	char *render;
-	unsigned char *hl;
+	//hl is run-length encoded, hlcount spans covering all rsize characters
+	hlspan *hl;
+	int hlcount;
 	int hl_open_comment;
+	int flags;
+	//kept up to date by highlighting, survives the render/hl being dropped
+	struct bracketsum br;
 } erow;
 
+//A piece of one row's text held by a register. text is shared with the
+//document (see ROW STORAGE), full means the piece is the whole row
+struct slice {
+	char *text;
+	int off;
+	int len;
+	int full;
+};
+
+//What copy/cut put aside for paste, one slice per line
+struct editorRegister {
+	struct slice *slices;
+	int count;
+};
+
+enum symbolKind {
+	SYM_FUNCTION = 0,
+	SYM_STRUCT,
+	SYM_UNION,
+	SYM_ENUM,
+	SYM_TYPEDEF
+};
+
+//A symbol defined in a block. row is counted from the start of the block and
+//depth is the bracket depth relative to it, see OUTLINE
+struct symbol {
+	char *name;
+	int row;
+	int rx;
+	int depth;
+	int kind;
+};
+
+struct outlineEntry {
+	char name[KILO_SYMBOL_NAME];
+	int row;
+	int rx;
+	int kind;
+};
+
+//A run of consecutive rows. The hash and byte count cover the rows as they'd
+//be saved (each followed by a newline) and are only worked out when needed.
+//offset is where the block starts in the saved file
+struct rowblock {
+	int start;
+	int nrows;
+	long bytes;
+	long offset;
+	uint64_t hash;
+	int valid;
+	int sized;
+	//unmatched brackets of the rows in the block, see BRACKETS
+	struct bracketsum br;
+	int br_valid;
+	//symbols starting in the block, see OUTLINE
+	struct symbol *syms;
+	int nsyms;
+	int syms_valid;
+	//came from the open cache and its rows haven't been highlighted yet, only
+	//the last one's hl_open_comment and the block's br are known (see OPEN CACHE)
+	int cold;
+};
+
+//Node of the identifier trie. label is the edge from the parent, count how
+//many times the word ending here occurs and best the highest count of any
+//word under it. Kids are sorted by the first byte of their label
+struct trienode {
+	char *label;
+	int len;
+	int count;
+	int best;
+	struct trienode **kids;
+	int nkids;
+};
+
+struct editorWords {
+	//NULL until the first completion builds it
+	struct trienode *root;
+	long words;
+	long nodes;
+	long bytes;
+};
+
+//Matches offered for the word before the cursor, most frequent first
+struct editorCompletion {
+	char words[KILO_COMPLETE_MAX][KILO_WORD_MAX + 1];
+	int counts[KILO_COMPLETE_MAX];
+	int count;
+	int pick;
+	//how much of the word was typed
+	int prefix;
+	//the last key was a completion, so the next one cycles
+	int active;
+};
+
+//Keys recorded for replay
+struct editorMacro {
+	int *keys;
+	int len;
+	int cap;
+	//next key to hand out while playing
+	int pos;
+};
+
+//A file shown in the hex view, see HEX. pages lists the pages of the mapping
+//that were changed and not saved yet, in order
+struct editorHex {
+	int fd;
+	unsigned char *map;
+	long size;
+	//how much of the file is mapped, size can drop below it if the file
+	//shrinks while there are unsaved changes
+	long maplen;
+	int writable;
+	long pagesize;
+	//hex digits in the offset column
+	int digits;
+	long *pages;
+	int npages;
+	int cap;
+};
+
+//An open file that isn't the current one, see BUFFERS. The cursor columns
+//don't include the line number gutter since its width goes with numrows
+struct editorBuffer {
+	char *filename;
+	erow *row;
+	int numrows;
+	int dirty;
+	int cx, cy;
+	int rowoff;
+	int coloff;
+	struct editorSyntax *syntax;
+	int mark_set;
+	int mark_cx, mark_cy;
+	int stale_rows;
+	int stale_from;
+	struct rowblock *blocks;
+	int nblocks;
+	int cold_blocks;
+	int offsets_from;
+	struct bracketsum *br_tree;
+	int br_size;
+	int br_stale;
+	int *br_dirty;
+	int br_ndirty;
+	int br_cap;
+	int br_hint;
+	int lru_hand;
+	struct stat file_stat;
+	struct editorHex *hex;
+	struct compressor *compress;
+	//what its rows take up, counted when it was put aside
+	long bytes;
+	//its rows were let go and it gets read from the file again when it's next used
+	int cold;
+	//buf_clock when it was last the current buffer
+	unsigned long used;
+};
+
+#define WIN_LEAF 0
+//a split with its kids one above the other, or side by side
+#define WIN_ROWS 1
+#define WIN_COLS 2
+
+//A window shows part of a buffer, see WINDOWS. Splits are windows too, with
+//two kids sharing their space and no buffer of their own
+struct editorWindow {
+	int split;
+	struct editorWindow *kids[2];
+	struct editorWindow *parent;
+	int buf;
+	//the view while it isn't the current window, cx without the gutter
+	int cx, cy;
+	int rowoff;
+	int coloff;
+	//where its text goes on screen, its status line is the row below
+	int top, left;
+	int rows, cols;
+	//gutter width it was last drawn with, 0 if it has to be drawn again
+	int drawn_ln;
+};
+
 struct editorConfig{
 	int cx, cy;
 	int rx;
@@ -94,6 +419,115 @@ struct editorConfig{
 	time_t statusmsg_time;
 	struct editorSyntax *syntax;
 	struct termios orig_termios;
+	//derived row data cache
+	long derived_bytes;
+	long derived_budget;
+	int lru_hand;
+	unsigned long cache_hits;
+	unsigned long cache_misses;
+	unsigned long cache_evictions;
+	//what the stats page is showing, if anything
+	int stats_view;
+	//calls through the allocation wrappers, see MEMORY
+	unsigned long mem_allocs;
+	unsigned long mem_reallocs;
+	unsigned long mem_frees;
+	//selection runs from the mark to the cursor
+	int mark_set;
+	int mark_cx, mark_cy;
+	struct editorRegister reg;
+	unsigned long cow_copies;
+	struct editorMacro macro;
+	int macro_recording;
+	//while set, keys come from the macro and nothing gets drawn or highlighted
+	int macro_playing;
+	//rows waiting on highlighting, and the lowest index any of them can be at
+	int stale_rows;
+	int stale_from;
+	struct rowblock *blocks;
+	int nblocks;
+	//how many blocks are cold, so highlighting doesn't have to look when none are
+	int cold_blocks;
+	//blocks after this one have stale offsets
+	int offsets_from;
+	//tree of bracket summaries over the blocks, br_size leaves. br_stale means
+	//blocks were added or removed and it needs building again, otherwise
+	//br_dirty lists the blocks whose leaves need updating
+	struct bracketsum *br_tree;
+	int br_size;
+	int br_stale;
+	int *br_dirty;
+	int br_ndirty;
+	int br_cap;
+	//block a row last marked its brackets changed in
+	int br_hint;
+	//the bracket paired with the one under the cursor, as a render index
+	int match_cy;
+	int match_rx;
+	struct editorWords words;
+	struct editorCompletion comp;
+	//top level symbols while the outline prompt is up
+	struct outlineEntry *outline;
+	int outline_len;
+	int outline_cap;
+	int outline_pick;
+	//every open buffer, the current one lives in E and its slot is filled in
+	//when it's put aside. alt_buf is the one that was current before it
+	struct editorBuffer *bufs;
+	int nbufs;
+	int cur_buf;
+	int alt_buf;
+	unsigned long buf_clock;
+	long memory_budget;
+	unsigned long buf_reloads;
+	//files opened from their open cache
+	unsigned long open_cache_hits;
+	//the window layout and the current window, whose view is the cursor and
+	//offsets in E with screenrows/screencols its size. The windows share
+	//termrows x termcols
+	struct editorWindow *win_root;
+	struct editorWindow *win;
+	int nwins;
+	int termrows;
+	int termcols;
+	//rows of the current buffer from here down changed since the last frame
+	int damage_from;
+	//inotify instance and the watch on the open file's directory
+	int watch_fd;
+	int watch_wd;
+	//the file as we last loaded or saved it, to tell our own writes apart
+	struct stat file_stat;
+	//follow mode: the file kept open, how much of it is in the buffer, whether
+	//the last row is a line still being written (and E.dirty when it was read),
+	//and whether there's more to read
+	int follow_fd;
+	long follow_off;
+	int follow_partial;
+	int follow_dirty;
+	int follow_more;
+	//set when the buffer is a file in the hex view, which has no rows
+	struct editorHex *hex;
+	//how the file is compressed, it's read and saved through this
+	struct compressor *compress;
+	//a redraw that's owed for changes that didn't come from a key
+	int redraw_pending;
+	unsigned long long last_redraw;
+	//terminal, headless mode swaps these for a script and a sink
+	int headless;
+	int infd;
+	int outfd;
+	//per-keypress latency, timed from editorReadKey returning a key until
+	//the next time it is called
+	struct latency op_latency[OP_COUNT];
+	int key_op;
+	int key_context;
+	unsigned long long key_start;
+	//per-phase timing and the perf HUD in the status bar
+	struct latency phase_latency[PH_COUNT];
+	unsigned long long last_frame_ns;
+	int last_frame_bytes;
+	int peak_frame_bytes;
+	int perf_hud;
 };
 
 struct editorConfig E;
@@ -114,23 +548,255 @@ struct editorSyntax HLDB[] = {
 		C_HL_extensions,
 		C_HL_keywords,
 		"//", "/*", "*/",
-		HL_HIGHLIGHT_NUMBERS | HL_HIGHLIGHT_STRINGS
+		HL_HIGHLIGHT_NUMBERS | HL_HIGHLIGHT_STRINGS | HL_OUTLINE
 	},
 };
 
 #define HLDB_ENTRIES (sizeof(HLDB) / sizeof(HLDB[0]))
 
+struct compressor COMPRESSORS[] = {
+	{"gzip", "\x1f\x8b", 2, ".gz", "gzip -dc", "gzip -c"},
+	{"zstd", "\x28\xb5\x2f\xfd", 4, ".zst", "zstd -dcq", "zstd -cq"},
+	{"xz", "\xfd" "7zXZ", 5, ".xz", "xz -dc", "xz -c"},
+	//the block size digit, then the magic of the first block, or of the end
+	//of the stream if there's nothing in it
+	{"bzip2", "BZh#1AY&SY", 10, ".bz2", "bzip2 -dc", "bzip2 -c"},
+	{"bzip2", "BZh#\x17rE8P\x90", 10, ".bz2", "bzip2 -dc", "bzip2 -c"},
+};
+
+#define COMPRESSORS_ENTRIES (sizeof(COMPRESSORS) / sizeof(COMPRESSORS[0]))
+
 /*** PROTOTYPES ***/
 
+struct newRows;
+
 void editorSetStatusMessage(const char *fmt, ...);
 void editorRefreshScreen();
+void editorUpdateRender(erow *row);
+void editorRenderRow(erow *row);
 char *editorPrompt(char *prompt, void (*callback)(char *, int));
+int editorMacroNextKey();
+void editorMacroRecord(int c);
+void editorToggleRecording();
+void editorPlayMacro(int count);
+void editorScroll();
+void editorWatchFile();
+int editorWatchEvents();
+int editorFollowRead();
+void editorBracketsChanged(int at);
+void editorRowEnsureDerived(erow *row);
+int editorRowCharsToRender(erow *row, int at);
+void editorWordsAddRow(erow *row);
+void editorWordsRemoveRow(erow *row);
+void editorSymbolsDirty(int b);
+void editorSymbolsChanged(int at);
+void editorBlockDropSymbols(struct rowblock *blk);
+void configureLNLength();
+void editorDamage(int at);
+int editorRowShown(int at);
+int editorBufferShown(int i);
+struct editorWindow *editorWindowFirst(struct editorWindow *w);
+struct editorWindow *editorWindowAfter(struct editorWindow *w);
+void editorWindowsInvalidate();
+void editorBufferSwitch(int i);
+int editorFileIsBinary(char *filename);
+int editorHexOpen(char *filename);
+void editorHexSave();
+void editorHexReload();
+struct compressor *editorCompression(char *head, int len);
+struct compressor *editorFileCompression(int fd);
+int editorLoadFile(char *filename);
+int editorDecompress(int fd, struct compressor *z, struct newRows *nr);
+void editorSaveCompressed();
+void editorShowStats(int page);
+int editorBlockFind(int at);
+void editorBlockWarm(int b);
+int editorCacheLoad(char *filename, struct stat *st, char *data);
+void editorCacheSave(char *filename, struct stat *st, char *data);
+int editorMemoryDump(const char *path);
+
+/*** TIMING ***/
+
+const char *editorOpNames[OP_COUNT] = {
+	"other", "open", "insert", "newline", "delete", "find", "scroll", "save"
+};
+
+const char *editorPhaseNames[PH_COUNT] = {
+	"key", "input", "syntax", "draw", "write", "frame"
+};
+
+unsigned long long nowNanos(){
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (unsigned long long)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+int latencyBucket(unsigned long long ns){
+	if (ns < (1 << LAT_SUB_BITS)) return ns;
+	int e = 0;
+	while ((ns >> e) >= (2 << LAT_SUB_BITS)) e++;
+	//e + 1 is how far past the linear range we are, the top bits pick the sub bucket
+	return ((e + 1) << LAT_SUB_BITS) + (int)((ns >> e) & ((1 << LAT_SUB_BITS) - 1));
+}
+
+//smallest value that lands in bucket b
+unsigned long long latencyBucketFloor(int b){
+	if (b < (1 << LAT_SUB_BITS)) return b;
+	int e = (b >> LAT_SUB_BITS) - 1;
+	unsigned long long m = (b & ((1 << LAT_SUB_BITS) - 1)) | (1 << LAT_SUB_BITS);
+	return m << e;
+}
+
+void latencyRecord(struct latency *l, unsigned long long ns){
+	l->count++;
+	l->total += ns;
+	if (ns > l->max) l->max = ns;
+	l->buckets[latencyBucket(ns)]++;
+}
+
+//p is 0-100, result is accurate to about 6%
+unsigned long long latencyPercentile(struct latency *l, double p){
+	if (l->count == 0) return 0;
+	unsigned long rank = (unsigned long)(l->count * p / 100.0);
+	if (rank >= l->count) rank = l->count - 1;
+	unsigned long seen = 0;
+	for (int b = 0; b < LAT_BUCKETS; b++){
+		seen += l->buckets[b];
+		if (seen > rank){
+			unsigned long long v = latencyBucketFloor(b);
+			return v > l->max ? l->max : v;
+		}
+	}
+	return l->max;
+}
+
+//Figure out what kind of operation a key is for the latency tables
+int editorKeyOp(int c){
+	if (E.key_context) return E.key_context;
+	switch (c){
+		case '\r': return OP_NEWLINE;
+		case BACKSPACE:
+		case CTRL_KEY('h'):
+		case DEL_KEY: return OP_DELETE;
+		case CTRL_KEY('f'): return OP_FIND;
+		case CTRL_KEY('k'): return OP_DELETE;
+		case CTRL_KEY('s'): return OP_SAVE;
+		case ARROW_UP:
+		case ARROW_DOWN:
+		case ARROW_LEFT:
+		case ARROW_RIGHT:
+		case PAGE_UP:
+		case PAGE_DOWN:
+		case HOME_KEY:
+		case END_KEY: return OP_SCROLL;
+	}
+	if (c == '\t' || (c >= 32 && c < 127) || (c >= 128 && c < 256)) return OP_INSERT;
+	return OP_OTHER;
+}
+
+void editorLatencyStart(int c){
+	E.key_op = editorKeyOp(c);
+	E.key_start = nowNanos();
+}
+
+void editorLatencyEnd(){
+	if (E.key_start == 0) return;
+	unsigned long long ns = nowNanos() - E.key_start;
+	latencyRecord(&E.op_latency[E.key_op], ns);
+	latencyRecord(&E.phase_latency[PH_KEY], ns);
+	E.key_start = 0;
+}
+
+//Returns how long it has been since start, and records it under phase
+unsigned long long editorPhaseEnd(int phase, unsigned long long start){
+	unsigned long long ns = nowNanos() - start;
+	latencyRecord(&E.phase_latency[phase], ns);
+	return ns;
+}
+
+void latencyDump(FILE *fp, const char *name, struct latency *l){
+	if (l->count == 0) return;
+	fprintf(fp, "%s: count %lu mean %.1f p50 %.1f p90 %.1f p99 %.1f max %.1f (usec)\n",
+		name, l->count, l->total / 1000.0 / l->count, latencyPercentile(l, 50) / 1000.0,
+		latencyPercentile(l, 90) / 1000.0, latencyPercentile(l, 99) / 1000.0, l->max / 1000.0);
+	for (int b = 0; b < LAT_BUCKETS; b++){
+		if (l->buckets[b])
+			fprintf(fp, "  >= %llu ns: %u\n", latencyBucketFloor(b), l->buckets[b]);
+	}
+}
+
+//Write out every histogram we have, for looking at after the fact
+int editorDumpHistograms(const char *path){
+	FILE *fp = fopen(path, "w");
+	if (!fp) return -1;
+	for (int ph = 0; ph < PH_COUNT; ph++){
+		char name[32];
+		snprintf(name, sizeof(name), "phase %s", editorPhaseNames[ph]);
+		latencyDump(fp, name, &E.phase_latency[ph]);
+	}
+	for (int op = 0; op < OP_COUNT; op++){
+		char name[32];
+		snprintf(name, sizeof(name), "op %s", editorOpNames[op]);
+		latencyDump(fp, name, &E.op_latency[op]);
+	}
+	fclose(fp);
+	return 0;
+}
+
+void editorLatencyReport(FILE *fp){
+	fprintf(fp, "%-8s %8s %10s %10s %10s %10s  (usec)\n",
+		"op", "count", "p50", "p90", "p99", "max");
+	for (int op = 0; op < OP_COUNT; op++){
+		struct latency *l = &E.op_latency[op];
+		if (l->count == 0) continue;
+		fprintf(fp, "%-8s %8lu %10.1f %10.1f %10.1f %10.1f\n", editorOpNames[op], l->count,
+			latencyPercentile(l, 50) / 1000.0, latencyPercentile(l, 90) / 1000.0,
+			latencyPercentile(l, 99) / 1000.0, l->max / 1000.0);
+	}
+}
+
+/*** MEMORY ***/
+
+//Everything the editor allocates goes through these: rows, their text, render
+//and highlighting, the blocks and bracket tree over them, buffers, windows,
+//the frame buffer and scratch space like a save's copy of the text, so the
+//stats can say how much allocating the editor does. A realloc of NULL is
+//an allocation and one that moves a block counts as a realloc, not a free and
+//an allocation
+
+void *memAlloc(size_t size){
+	E.mem_allocs++;
+	return malloc(size);
+}
+
+void *memCalloc(size_t n, size_t size){
+	E.mem_allocs++;
+	return calloc(n, size);
+}
+
+void *memRealloc(void *p, size_t size){
+	if (p) E.mem_reallocs++;
+	else E.mem_allocs++;
+	return realloc(p, size);
+}
+
+void memFree(void *p){
+	if (p) E.mem_frees++;
+	free(p);
+}
+
+char *memStrdup(const char *s){
+	size_t len = strlen(s) + 1;
+	char *p = memAlloc(len);
+	if (p) memcpy(p, s, len);
+	return p;
+}
 
 /*** TERMINAL ****/
 
 void die(const char *s){
-	write(STDOUT_FILENO, "\x1b[2J", 4);
-	write(STDOUT_FILENO, "\x1b[H", 3);
+	write(E.outfd, "\x1b[2J", 4);
+	write(E.outfd, "\x1b[H", 3);
 	perror(s);
 	exit(1);
 }
@@ -156,21 +822,66 @@ void enableRawMode(){
 	raw.c_cc[VTIME] = 1;
 }
 
-int editorReadKey(){
+//Block until there's a key to read, dealing with changes to the open file
+//while we wait
+void editorWaitForKey(){
+	if (E.watch_fd == -1 && E.follow_fd == -1) return;
+	while (1){
+		struct pollfd fds[2];
+		int nfds = 1;
+		fds[0].fd = E.infd;
+		fds[0].events = POLLIN;
+		if (E.watch_fd != -1){
+			fds[1].fd = E.watch_fd;
+			fds[1].events = POLLIN;
+			nfds++;
+		}
+		int timeout = -1;
+		if (E.follow_fd != -1) timeout = E.follow_more ? 0 : KILO_FOLLOW_POLL_MS;
+		unsigned long long now = nowNanos();
+		if (E.redraw_pending){
+			long wait = KILO_FOLLOW_FRAME_MS - (long)((now - E.last_redraw) / 1000000);
+			if (wait < 0) wait = 0;
+			if (timeout == -1 || wait < timeout) timeout = wait;
+		}
+		int ready = poll(fds, nfds, timeout);
+		if (ready == -1){
+			if (errno == EINTR) continue;
+			return;
+		}
+		if (nfds > 1 && (fds[1].revents & POLLIN) && editorWatchEvents()) E.redraw_pending = 1;
+		if (fds[0].revents) return;
+		//nothing from inotify, but a file on a network mount might not send any
+		if (E.follow_fd != -1 && (ready == 0 || E.follow_more) && editorFollowRead())
+			E.redraw_pending = 1;
+		//appends can come in faster than it's worth drawing them
+		now = nowNanos();
+		if (E.redraw_pending && now - E.last_redraw >= KILO_FOLLOW_FRAME_MS * 1000000ULL){
+			editorRefreshScreen();
+			E.redraw_pending = 0;
+			E.last_redraw = now;
+		}
+	}
+}
+
+int editorDecodeKey(){
 	int nread;
 	char c;
-	while ((nread = read(STDIN_FILENO, &c, 1)) != 1){
+	editorWaitForKey();
+	while ((nread = read(E.infd, &c, 1)) != 1){
 		if (nread == -1 && errno != EAGAIN) die("read");
+		//a replayed script running out is the end of the session
+		if (nread == 0 && E.headless) exit(0);
 	}
 
 	if (c == '\x1b'){
 		char seq[3];
 
-		if (read(STDIN_FILENO, &seq[0], 1) != 1) return '\x1b';
-		if (read(STDIN_FILENO, &seq[1], 1) != 1) return '\x1b';
+		if (read(E.infd, &seq[0], 1) != 1) return '\x1b';
+		if (read(E.infd, &seq[1], 1) != 1) return '\x1b';
 		if (seq[0] == '['){
 			if (seq[1] >= '0' && seq[1] <= '9'){
-				if (read(STDIN_FILENO, &seq[2], 1) != 1) return '\x1b';
+				if (read(E.infd, &seq[2], 1) != 1) return '\x1b';
 				if (seq[2] == '~'){
 					switch (seq[1]){
 						case '1': return HOME_KEY;
@@ -203,8 +914,20 @@ int editorReadKey(){
 		return '\x1b';
 	}
 	else{
-		return c;
+		return (unsigned char)c;
 	}
+	return (unsigned char)c;
+}
+
+//Everything that wants a key goes through here, which is also where the
+//time spent handling the previous key gets recorded
+int editorReadKey(){
+	//a playing macro's keys aren't timed one by one, the whole replay is one key
+	if (E.macro_playing) return editorMacroNextKey();
+	editorLatencyEnd();
+	int c = editorDecodeKey();
+	editorLatencyStart(c);
+	if (E.macro_recording) editorMacroRecord(c);
 	return c;
 }
 
@@ -233,6 +956,13 @@ int getCursorPosition(int *rows, int *cols){
 int getWindowSize(int *rows, int *cols){
 	struct winsize ws;
 
+	//the fake terminal is whatever size we were told it is
+	if (E.headless){
+		*rows = E.screenrows;
+		*cols = E.screencols;
+		return 0;
+	}
+
 	if (ioctl(STDOUT_FILENO, TIOCGWINSZ, &ws) == -1 || ws.ws_col == 0){
 		//fallback window sizing if ioctl() can't request window size
 		//C command moves cursor right, B command moves cursor down
@@ -247,19 +977,304 @@ int getWindowSize(int *rows, int *cols){
 	}
 }
 
+/*** UTF-8 ***/
+
+//Rows are stored as UTF-8 bytes. cx counts bytes, rx counts display columns.
+//Rows that turn out to be pure ASCII get ROW_ASCII and skip all of this
+
+//Is s[0..len) all 7-bit? Checks 64 bytes per step with SSE2 where we have it
+int editorIsAscii(const char *s, int len){
+	int i = 0;
+#ifdef __SSE2__
+	for (; i + 64 <= len; i += 64){
+		__m128i a = _mm_loadu_si128((const __m128i *)(s + i));
+		__m128i b = _mm_loadu_si128((const __m128i *)(s + i + 16));
+		__m128i c = _mm_loadu_si128((const __m128i *)(s + i + 32));
+		__m128i d = _mm_loadu_si128((const __m128i *)(s + i + 48));
+		__m128i any = _mm_or_si128(_mm_or_si128(a, b), _mm_or_si128(c, d));
+		if (_mm_movemask_epi8(any)) return 0;
+	}
+	for (; i + 16 <= len; i += 16){
+		if (_mm_movemask_epi8(_mm_loadu_si128((const __m128i *)(s + i)))) return 0;
+	}
+#endif
+	//8 bytes at a time for whatever is left
+	for (; i + 8 <= len; i += 8){
+		uint64_t w;
+		memcpy(&w, s + i, 8);
+		if (w & 0x8080808080808080ULL) return 0;
+	}
+	for (; i < len; i++)
+		if ((unsigned char)s[i] & 0x80) return 0;
+	return 1;
+}
+
+//Decode the character at s, looking at no more than len bytes. Returns how
+//many bytes it takes up, *cp is -1 if it isn't valid UTF-8 (then it's 1 byte)
+int utf8Decode(const char *s, int len, int *cp){
+	unsigned char b = s[0];
+	int n, c;
+	if (b < 0x80){
+		*cp = b;
+		return 1;
+	}
+	else if (b >= 0xc2 && b < 0xe0){ n = 2; c = b & 0x1f; }
+	else if (b >= 0xe0 && b < 0xf0){ n = 3; c = b & 0x0f; }
+	else if (b >= 0xf0 && b < 0xf5){ n = 4; c = b & 0x07; }
+	else{
+		*cp = -1;
+		return 1;
+	}
+	if (n > len){
+		*cp = -1;
+		return 1;
+	}
+	for (int i = 1; i < n; i++){
+		if (((unsigned char)s[i] & 0xc0) != 0x80){
+			*cp = -1;
+			return 1;
+		}
+		c = (c << 6) | (s[i] & 0x3f);
+	}
+	//reject overlong encodings, surrogates and things past the end of unicode
+	if ((n == 3 && c < 0x800) || (n == 4 && (c < 0x10000 || c > 0x10ffff)) ||
+		(c >= 0xd800 && c <= 0xdfff)){
+		*cp = -1;
+		return 1;
+	}
+	*cp = c;
+	return n;
+}
+
+struct interval {
+	int first;
+	int last;
+};
+
+//Combining marks and other things that sit on top of the previous character
+static const struct interval zero_width[] = {
+	{0x0300, 0x036f}, {0x0483, 0x0489}, {0x0591, 0x05bd}, {0x05bf, 0x05bf},
+	{0x05c1, 0x05c2}, {0x05c4, 0x05c5}, {0x05c7, 0x05c7}, {0x0610, 0x061a},
+	{0x064b, 0x065f}, {0x0670, 0x0670}, {0x06d6, 0x06dc}, {0x06df, 0x06e4},
+	{0x0900, 0x0902}, {0x093c, 0x093c}, {0x0941, 0x0948}, {0x094d, 0x094d},
+	{0x0e31, 0x0e31}, {0x0e34, 0x0e3a}, {0x0e47, 0x0e4e}, {0x1ab0, 0x1aff},
+	{0x1dc0, 0x1dff}, {0x200b, 0x200f}, {0x202a, 0x202e}, {0x2060, 0x2064},
+	{0x20d0, 0x20ff}, {0xfe00, 0xfe0f}, {0xfe20, 0xfe2f}, {0xfeff, 0xfeff},
+	{0xe0100, 0xe01ef}
+};
+
+//East Asian wide and fullwidth characters, plus the emoji blocks
+static const struct interval double_width[] = {
+	{0x1100, 0x115f}, {0x231a, 0x231b}, {0x2329, 0x232a}, {0x23e9, 0x23ec},
+	{0x2614, 0x2615}, {0x2e80, 0x303e}, {0x3041, 0x33ff}, {0x3400, 0x4dbf},
+	{0x4e00, 0x9fff}, {0xa000, 0xa4cf}, {0xa960, 0xa97f}, {0xac00, 0xd7a3},
+	{0xf900, 0xfaff}, {0xfe10, 0xfe19}, {0xfe30, 0xfe6f}, {0xff00, 0xff60},
+	{0xffe0, 0xffe6}, {0x1f300, 0x1f64f}, {0x1f900, 0x1f9ff}, {0x20000, 0x2fffd},
+	{0x30000, 0x3fffd}
+};
+
+int inIntervals(int cp, const struct interval *table, int n){
+	if (cp < table[0].first || cp > table[n - 1].last) return 0;
+	int lo = 0, hi = n - 1;
+	while (lo <= hi){
+		int mid = (lo + hi) / 2;
+		if (cp > table[mid].last) lo = mid + 1;
+		else if (cp < table[mid].first) hi = mid - 1;
+		else return 1;
+	}
+	return 0;
+}
+
+//How many columns a character takes up. Invalid bytes and control characters
+//get drawn as a single inverted symbol, so they're 1
+int codepointWidth(int cp){
+	if (cp < 0x300) return 1;
+	if (inIntervals(cp, zero_width, sizeof(zero_width) / sizeof(zero_width[0]))) return 0;
+	if (inIntervals(cp, double_width, sizeof(double_width) / sizeof(double_width[0]))) return 2;
+	return 1;
+}
+
+//Width of the character starting at s, and its length in bytes through *n
+int utf8Width(const char *s, int len, int *n){
+	int cp;
+	*n = utf8Decode(s, len, &cp);
+	return cp < 0 ? 1 : codepointWidth(cp);
+}
+
+//Byte index of the character after the one at i, skipping any combining
+//marks that go with it
+int utf8Next(const char *s, int len, int i){
+	int n;
+	if (i >= len) return len;
+	utf8Width(&s[i], len - i, &n);
+	i += n;
+	while (i < len && utf8Width(&s[i], len - i, &n) == 0) i += n;
+	return i;
+}
+
+//Byte index of the start of the character before i
+int utf8Prev(const char *s, int len, int i){
+	while (i > 0){
+		i--;
+		//back up over continuation bytes to the start of the character
+		int start = i;
+		while (start > 0 && i - start < 3 && ((unsigned char)s[start] & 0xc0) == 0x80) start--;
+		int n;
+		int w = utf8Width(&s[start], len - start, &n);
+		if (start + n > i) i = start;
+		//keep going if that was a combining mark, it belongs to what's before it
+		if (w != 0 || i == 0) return i;
+	}
+	return 0;
+}
+
 /*** SYNTAX HIGHLIGHTING ***/
 
 int is_separator(int c){
 	return isspace(c) || c == '\0' || strchr(",.()+-/*=~%<>[];", c) != NULL;
 }
 
-//Go through a row and update the highlighting of each character
-void editorUpdateSyntax(erow *row){
+//Scratch buffer holding one highlight class per render character. Rows only
+//keep the run-length encoded form, this gets reused for every row we touch
+static unsigned char *hlbuf = NULL;
+static int hlbuf_cap = 0;
+
+unsigned char *editorHighlightScratch(int len){
+	if (hlbuf == NULL || len > hlbuf_cap){
+		hlbuf_cap = len * 2 + 16;
+		hlbuf = memRealloc(hlbuf, hlbuf_cap);
+	}
+	return hlbuf;
+}
+
+//Squash a per-character highlight array into spans and store them on the row
+void editorEncodeHighlight(erow *row, unsigned char *hl){
+	E.derived_bytes -= sizeof(hlspan) * row->hlcount;
+	int count = 0;
+	int i;
+	for (i = 0; i < row->rsize; i++){
+		if (i == 0 || hl[i] != hl[i - 1]) count++;
+	}
+	//spans are capped in length, so really long runs need extra entries
+	count += row->rsize / HLSPAN_MAX_LEN;
+	if (count == 0){
+		memFree(row->hl);
+		row->hl = NULL;
+		row->hlcount = 0;
+		return;
+	}
+
+	row->hl = memRealloc(row->hl, sizeof(hlspan) * count);
+	row->hlcount = 0;
+	for (i = 0; i < row->rsize; i++){
+		hlspan *last = row->hlcount ? &row->hl[row->hlcount - 1] : NULL;
+		if (last && last->hl == hl[i] && last->len < HLSPAN_MAX_LEN){
+			last->len++;
+		}
+		else{
+			row->hl[row->hlcount].len = 1;
+			row->hl[row->hlcount].hl = hl[i];
+			row->hlcount++;
+		}
+	}
+	E.derived_bytes += sizeof(hlspan) * row->hlcount;
+}
+
+//Expand a row's spans back out to one class per character (into the scratch buffer)
+unsigned char *editorDecodeHighlight(erow *row){
+	unsigned char *hl = editorHighlightScratch(row->rsize);
+	int pos = 0;
+	for (int s = 0; s < row->hlcount; s++){
+		memset(&hl[pos], row->hl[s].hl, row->hl[s].len);
+		pos += row->hl[s].len;
+	}
+	return hl;
+}
+
+//Paint [at, at+len) of the render with a single highlight class
+void editorRowSetHighlight(erow *row, int at, int len, int cls){
+	if (at < 0 || at >= row->rsize) return;
+	if (at + len > row->rsize) len = row->rsize - at;
+	unsigned char *hl = editorDecodeHighlight(row);
+	memset(&hl[at], cls, len);
+	editorEncodeHighlight(row, hl);
+}
+
+void editorUpdateSyntax(erow *row);
+int editorBlockWarmRows(int b);
+
+static inline int bracketOpens(char c){
+	return c == '(' || c == '[' || c == '{';
+}
+
+static inline int bracketCloses(char c){
+	return c == ')' || c == ']' || c == '}';
+}
+
+//Brackets inside strings and comments don't pair up with anything
+static inline int bracketCounts(unsigned char cls){
+	return cls != HL_STRING && cls != HL_COMMENT && cls != HL_MLCOMMENT;
+}
+
+//Work out the row's bracket summary from its fresh highlighting
+void editorRowBrackets(erow *row, unsigned char *hl){
+	struct bracketsum s = {0, 0};
+	for (int i = 0; i < row->rsize; i++){
+		char c = row->render[i];
+		if (bracketOpens(c)){
+			if (bracketCounts(hl[i])) s.open++;
+		}
+		else if (bracketCloses(c) && bracketCounts(hl[i])){
+			if (s.open > 0) s.open--;
+			else s.close++;
+		}
+	}
+	if (s.open != row->br.open || s.close != row->br.close){
+		row->br = s;
+		editorBracketsChanged(row->idx);
+	}
+}
+
+//While a macro plays, rows just get plain spans matching their render and are
+//marked stale, editorHighlightStale does them all properly afterwards
+void editorHighlightDefer(erow *row){
+	if (!(row->flags & ROW_DERIVED)) editorRenderRow(row);
+	unsigned char *hl = editorHighlightScratch(row->rsize);
+	memset(hl, HL_NORMAL, row->rsize);
+	editorEncodeHighlight(row, hl);
+	if (!(row->flags & ROW_STALE)){
+		row->flags |= ROW_STALE;
+		E.stale_rows++;
+	}
+	if (row->idx < E.stale_from) E.stale_from = row->idx;
+}
+
+//Go through a row and update the highlighting of each character. Returns the
+//row that needs highlighting next because the comment state coming into it
+//changed, or -1
+int editorHighlightRow(erow *row){
+	if (E.macro_playing){
+		editorHighlightDefer(row);
+		return -1;
+	}
+	if (row->flags & ROW_STALE){
+		row->flags &= ~ROW_STALE;
+		E.stale_rows--;
+	}
+	//the comment state coming in isn't known inside a cold block, only at its ends
+	int next = E.cold_blocks ? editorBlockWarmRows(editorBlockFind(row->idx)) : -1;
+	//Rows that had their render dropped need it back before we can look at them
+	if (!(row->flags & ROW_DERIVED)) editorRenderRow(row);
+
 	//Start by filling the hl array with the default value
-	row->hl = realloc(row->hl, row->rsize);
-	memset(row->hl, HL_NORMAL, row->rsize);
+	unsigned char *hl = editorHighlightScratch(row->rsize);
+	memset(hl, HL_NORMAL, row->rsize);
 
-	if (E.syntax == NULL) return;
+	if (E.syntax == NULL){
+		editorEncodeHighlight(row, hl);
+		editorRowBrackets(row, hl);
+		return next;
+	}
 
 	char **keywords = E.syntax->keywords;
 
@@ -278,20 +1293,20 @@ void editorUpdateSyntax(erow *row){
 	int i = 0;
 	while (i < row->rsize){
 		char c = row->render[i];
-		unsigned char prev_hl = (i > 0) ? row->hl[i - 1] : HL_NORMAL;
+		unsigned char prev_hl = (i > 0) ? hl[i - 1] : HL_NORMAL;
 
 		if (scs_len && !in_string && !in_comment){
 			if (!strncmp(&row->render[i], scs, scs_len)){
-				memset(&row->hl[i], HL_COMMENT, row->rsize - i);
+				memset(&hl[i], HL_COMMENT, row->rsize - i);
 				break;
 			}
 		}
 
 		if (mcs_len && mce_len && !in_string){
 			if (in_comment){
-				row->hl[i] = HL_MLCOMMENT;
+				hl[i] = HL_MLCOMMENT;
 				if (!strncmp(&row->render[i], mce, mce_len)){
-					memset(&row->hl[i], HL_MLCOMMENT, mce_len);
+					memset(&hl[i], HL_MLCOMMENT, mce_len);
 					i += mce_len;
 					in_comment = 0;
 					prev_sep = 1;
@@ -303,7 +1318,7 @@ void editorUpdateSyntax(erow *row){
 				}
 			}
 			else if (!strncmp(&row->render[i], mcs, mcs_len)) {
-				memset(&row->hl[i], HL_MLCOMMENT, mcs_len);
+				memset(&hl[i], HL_MLCOMMENT, mcs_len);
 				i += mcs_len;
 				in_comment = 1;
 				continue;
@@ -312,9 +1327,9 @@ void editorUpdateSyntax(erow *row){
 
 		if (E.syntax->flags & HL_HIGHLIGHT_STRINGS){
 			if (in_string){
-				row->hl[i] = HL_STRING;
+				hl[i] = HL_STRING;
 				if (c == '\\' && i + 1 < row->rsize){
-					row->hl[i+1] = HL_STRING;
+					hl[i+1] = HL_STRING;
 					i += 2;
 					continue;
 				}
@@ -326,7 +1341,7 @@ void editorUpdateSyntax(erow *row){
 			else{
 				if (c == '"' || c == '\''){
 					in_string = c;
-					row->hl[i] = HL_STRING;
+					hl[i] = HL_STRING;
 					i++;
 					continue;
 				}
@@ -336,7 +1351,7 @@ void editorUpdateSyntax(erow *row){
 		if (E.syntax->flags & HL_HIGHLIGHT_NUMBERS) {
 			if ((isdigit(c) && (prev_sep || prev_hl == HL_NUMBER)) ||
 				(c == '.' && prev_hl == HL_NUMBER)) {
-				row->hl[i] = HL_NUMBER;
+				hl[i] = HL_NUMBER;
 				i++;
 				prev_sep = 0;
 				continue;
@@ -352,7 +1367,7 @@ void editorUpdateSyntax(erow *row){
 
 				if (!strncmp(&row->render[i], keywords[j], klen) &&
 					is_separator(row->render[i + klen])) {
-					memset(&row->hl[i], kw2 ? HL_KEYWORD2 : HL_KEYWORD1, klen);
+					memset(&hl[i], kw2 ? HL_KEYWORD2 : HL_KEYWORD1, klen);
 					i += klen;
 					break;
 				}
@@ -366,10 +1381,46 @@ void editorUpdateSyntax(erow *row){
 		prev_sep = is_separator(c);
 		i++;
 	}
+	editorEncodeHighlight(row, hl);
+	editorRowBrackets(row, hl);
+
 	int changed = (row->hl_open_comment != in_comment);
 	row->hl_open_comment = in_comment;
-	if (changed && row->idx + 1 < E.numrows)
-		editorUpdateSyntax(&E.row[row->idx = 1]);
+	//the next row's tokens change even if it doesn't get highlighted again yet
+	if (changed) editorSymbolsChanged(row->idx + 1);
+	if (changed) next = row->idx + 1;
+	return next < E.numrows ? next : -1;
+}
+
+//Highlight a row, then the rows after it for as long as the comment state
+//coming out of the last one changed, timing the whole cascade as one piece
+//of work. A comment opened at the top of a big file runs through every row
+//after it, so this is a loop rather than each row starting the next
+void editorUpdateSyntax(erow *row){
+	unsigned long long start = nowNanos();
+	int next = editorHighlightRow(row);
+	while (next != -1) next = editorHighlightRow(&E.row[next]);
+	editorPhaseEnd(PH_SYNTAX, start);
+}
+
+//Highlight the rows left stale by a macro in one pass. Starting at the first of
+//them, a row is redone if it's stale or the comment state coming into it changed,
+//and the pass stops once there's neither left
+void editorHighlightStale(){
+	if (E.stale_rows == 0) return;
+	unsigned long long start = nowNanos();
+	int carry = 1;
+	//a row further on that has to be redone, when warming a cold block changed
+	//the state it ends in
+	int pending = -1;
+	for (int j = E.stale_from; j < E.numrows && (E.stale_rows > 0 || carry || j <= pending); j++){
+		erow *row = &E.row[j];
+		if (!carry && j != pending && !(row->flags & ROW_STALE)) continue;
+		int next = editorHighlightRow(row);
+		carry = (next == j + 1);
+		if (next > j + 1) pending = next;
+	}
+	editorPhaseEnd(PH_SYNTAX, start);
 }
 
 int editorSyntaxToColor(int hl){
@@ -386,10 +1437,20 @@ int editorSyntaxToColor(int hl){
 }
 
 void editorSelectSyntaxHighlight(){
+	editorDamage(0);
 	E.syntax = NULL;
 	if (E.filename == NULL) return;
 
-	char *ext = strrchr(E.filename, '.');
+	//a compressed file is highlighted for what's in it, "log.c.gz" as C
+	char name[strlen(E.filename) + 1];
+	strcpy(name, E.filename);
+	char *ext = strrchr(name, '.');
+	for (unsigned int k = 0; ext && k < COMPRESSORS_ENTRIES; k++){
+		if (strcmp(ext, COMPRESSORS[k].suffix)) continue;
+		*ext = '\0';
+		ext = strrchr(name, '.');
+		break;
+	}
 
 	for (unsigned int j = 0; j < HLDB_ENTRIES; j++){
 		struct editorSyntax *s = &HLDB[j];
@@ -397,7 +1458,7 @@ void editorSelectSyntaxHighlight(){
 		while (s->filematch[i]){
 			int is_ext = (s->filematch[i][0] == '.');
 			if ((is_ext && ext && !strcmp(ext, s->filematch[i])) ||
-				(!is_ext && strstr(E.filename, s->filematch[i]))) {
+				(!is_ext && strstr(name, s->filematch[i]))) {
 				E.syntax = s;
 
 				int filerow;
@@ -411,106 +1472,981 @@ void editorSelectSyntaxHighlight(){
 	}
 }
 
-/*** ROW OPERATIONS ***/
+/*** ROW STORAGE ***/
 
-//Convert cursor position in the raw string to cursor position in the rendered string
-int editorRowCxToRx(erow *row, int cx){
-	int rx = E.ln_length;
-	int j;
-	//Adjust for TABS
-	for (j = E.ln_length; j < cx; j++){
-		if(row->chars[j-E.ln_length] == '\t')
-			rx += (KILO_TAB_STOP - 1) - ((rx-E.ln_length) % KILO_TAB_STOP);
-		rx++;
-	}
-	return rx;
+//Row text lives in a refcounted block so registers (and rows pasted from them)
+//can share it with the document instead of copying. Shared text is read only:
+//anything about to change a row's chars goes through editorRowReserve first,
+//which gives the row its own copy if somebody else is looking at it
+struct rowtext {
+	int refs;
+	char data[];
+};
+
+#define ROWTEXT(chars) ((struct rowtext *)((chars) - offsetof(struct rowtext, data)))
+
+//Room for len characters and the nul, owned by whoever asked for it
+char *rowTextAlloc(int len){
+	struct rowtext *t = memAlloc(sizeof(struct rowtext) + len + 1);
+	t->refs = 1;
+	return t->data;
 }
-//Convert cursor position in the rendered string into position in the raw string
-int editorRowRxToCx(erow *row, int rx){
-	int cur_rx = 0;
-	int cx;
-	for (cx = 0; cx < row->size; cx++){
-		if (row->chars[cx] == '\t')
-			cur_rx += (KILO_TAB_STOP - 1) - (cur_rx % KILO_TAB_STOP);
-		cur_rx++;
 
-		if (cur_rx > rx) return cx;
-	}
-	return cx;	
+char *rowTextRetain(char *chars){
+	if (chars) ROWTEXT(chars)->refs++;
+	return chars;
 }
 
-//Do operations on the raw text to get it into the state we want to actually render
-void editorUpdateRow(erow *row){
-	int tabs = 0;
-	int j;
-	//Allocate additional memory to render each tab character
-	for (j = 0; j < row->size; j++)
-		if (row->chars[j] == '\t') tabs++;
-	free(row->render);
-	row->render = malloc(row->size + tabs*(KILO_TAB_STOP - 1) + 1);
+void rowTextRelease(char *chars){
+	if (!chars) return;
+	struct rowtext *t = ROWTEXT(chars);
+	if (--t->refs == 0) memFree(t);
+}
 
-	int idx = 0;
-	for (j = 0; j < row->size; j++){
-		if(row->chars[j] == '\t'){
-			//Add spaces until we get to a tabstop
-			row->render[idx++] = ' ';
-			while (idx % KILO_TAB_STOP != 0) row->render[idx++] = ' ';
-		}
-		else{
-			row->render[idx++] = row->chars[j];
-		}
+//Make chars writable with room for len characters, copying it if it's shared
+void editorRowReserve(erow *row, int len){
+	//the text is about to change, take its words out while they're still there
+	editorWordsRemoveRow(row);
+	struct rowtext *t = ROWTEXT(row->chars);
+	if (t->refs > 1){
+		char *copy = rowTextAlloc(len);
+		int keep = row->size < len ? row->size : len;
+		memcpy(copy, row->chars, keep);
+		copy[keep] = '\0';
+		t->refs--;
+		row->chars = copy;
+		E.cow_copies++;
 	}
-	row->render[idx] = '\0';
+	else{
+		t = memRealloc(t, sizeof(struct rowtext) + len + 1);
+		row->chars = t->data;
+	}
+}
+
+/*** ROW BLOCKS ***/
+
+//Rows are grouped into blocks of about KILO_BLOCK_ROWS, so whole stretches of
+//the file can be compared against something else by hash without walking rows.
+//editorOpenRows/editorCloseRows keep the blocks lined up with the rows, and any
+//change to a row's text marks its block for rehashing
+
+//Hash that can be fed a piece at a time and comes out the same however the
+//input was split up
+struct blockhash {
+	uint64_t h;
+	uint64_t word;
+	int fill;
+	long len;
+};
+
+static inline uint64_t blockHashMix(uint64_t h, uint64_t w){
+	h ^= w;
+	h *= 0x9e3779b97f4a7c15ULL;
+	return h ^ (h >> 29);
+}
+
+void blockHashInit(struct blockhash *bh){
+	bh->h = 0xcbf29ce484222325ULL;
+	bh->word = 0;
+	bh->fill = 0;
+	bh->len = 0;
+}
+
+void blockHashUpdate(struct blockhash *bh, const char *p, long len){
+	bh->len += len;
+	//finish off a word started by the last piece
+	while (len > 0 && bh->fill > 0){
+		bh->word |= (uint64_t)(unsigned char)*p++ << (8 * bh->fill++);
+		len--;
+		if (bh->fill == 8){
+			bh->h = blockHashMix(bh->h, bh->word);
+			bh->word = 0;
+			bh->fill = 0;
+		}
+	}
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+	//whole words at a time, same as the loop below would put together
+	while (len >= 8){
+		uint64_t w;
+		memcpy(&w, p, 8);
+		bh->h = blockHashMix(bh->h, w);
+		p += 8;
+		len -= 8;
+	}
+#endif
+	while (len > 0){
+		bh->word |= (uint64_t)(unsigned char)*p++ << (8 * bh->fill++);
+		len--;
+		if (bh->fill == 8){
+			bh->h = blockHashMix(bh->h, bh->word);
+			bh->word = 0;
+			bh->fill = 0;
+		}
+	}
+}
+
+uint64_t blockHashFinal(struct blockhash *bh){
+	return blockHashMix(blockHashMix(bh->h, bh->word), (uint64_t)bh->len);
+}
+
+uint64_t blockHashBytes(const char *p, long len){
+	struct blockhash bh;
+	blockHashInit(&bh);
+	blockHashUpdate(&bh, p, len);
+	return blockHashFinal(&bh);
+}
+
+void editorBracketsDirty(int b);
+
+//Index of the block holding row at (the last block for one past the end)
+int editorBlockFind(int at){
+	int lo = 0, hi = E.nblocks - 1;
+	while (lo < hi){
+		int mid = (lo + hi + 1) / 2;
+		if (E.blocks[mid].start <= at) lo = mid;
+		else hi = mid - 1;
+	}
+	return lo;
+}
+
+//Block b's rows changed, so its hash and size are stale and so are the
+//offsets of every block after it
+void editorBlockDirty(int b){
+	E.blocks[b].valid = 0;
+	E.blocks[b].sized = 0;
+	if (b < E.offsets_from) E.offsets_from = b;
+	editorBracketsDirty(b);
+	editorSymbolsDirty(b);
+}
+
+void editorBlockInvalidate(int at){
+	editorDamage(at);
+	if (E.nblocks == 0) return;
+	editorBlockDirty(editorBlockFind(at));
+}
+
+//Saved size of block b, without hashing it
+long editorBlockSize(int b){
+	struct rowblock *blk = &E.blocks[b];
+	if (!blk->sized){
+		blk->bytes = 0;
+		for (int j = blk->start; j < blk->start + blk->nrows; j++) blk->bytes += E.row[j].size + 1;
+		blk->sized = 1;
+	}
+	return blk->bytes;
+}
+
+//Bring block offsets up to date, only from the first block whose offset is stale
+void editorBlockOffsets(){
+	if (E.nblocks == 0) return;
+	if (E.offsets_from == 0) E.blocks[0].offset = 0;
+	for (int b = E.offsets_from + 1; b < E.nblocks; b++)
+		E.blocks[b].offset = E.blocks[b - 1].offset + editorBlockSize(b - 1);
+	E.offsets_from = E.nblocks;
+}
+
+//Size of the whole file as it would be saved
+long editorFileSize(){
+	if (E.nblocks == 0) return 0;
+	editorBlockOffsets();
+	return E.blocks[E.nblocks - 1].offset + editorBlockSize(E.nblocks - 1);
+}
+
+//Row holding the byte at offset off of the saved file: a binary search over
+//the blocks, then a walk through at most one block's rows
+int editorRowAtOffset(long off){
+	if (E.nblocks == 0) return 0;
+	editorBlockOffsets();
+	int lo = 0, hi = E.nblocks - 1;
+	while (lo < hi){
+		int mid = (lo + hi + 1) / 2;
+		if (E.blocks[mid].offset <= off) lo = mid;
+		else hi = mid - 1;
+	}
+	struct rowblock *blk = &E.blocks[lo];
+	long pos = blk->offset;
+	int j = blk->start;
+	while (j < blk->start + blk->nrows - 1 && pos + E.row[j].size + 1 <= off){
+		pos += E.row[j].size + 1;
+		j++;
+	}
+	return j;
+}
+
+//Work out the hash and size of block b if a change has made them stale
+void editorBlockRefresh(int b){
+	struct rowblock *blk = &E.blocks[b];
+	if (blk->valid) return;
+	struct blockhash bh;
+	blockHashInit(&bh);
+	for (int j = blk->start; j < blk->start + blk->nrows; j++){
+		blockHashUpdate(&bh, E.row[j].chars, E.row[j].size);
+		blockHashUpdate(&bh, "\n", 1);
+	}
+	blk->bytes = bh.len;
+	blk->hash = blockHashFinal(&bh);
+	blk->valid = 1;
+	blk->sized = 1;
+}
+
+//Highlight every row of cold block b, carrying on from the comment state the
+//row before it ends in. Returns the row after the block if the block ends in
+//a different state than the cache said, so it needs redoing, otherwise -1
+int editorBlockWarmRows(int b){
+	struct rowblock *blk = &E.blocks[b];
+	if (!blk->cold) return -1;
+	blk->cold = 0;
+	E.cold_blocks--;
+	int last = blk->start + blk->nrows - 1;
+	int was_open = E.row[last].hl_open_comment;
+	for (int j = blk->start; j <= last; j++) editorHighlightRow(&E.row[j]);
+	if (E.row[last].hl_open_comment != was_open && last + 1 < E.numrows) return last + 1;
+	return -1;
+}
+
+//The same for anything other than highlighting a row, which carries on past
+//the block itself if it has to
+void editorBlockWarm(int b){
+	int next = editorBlockWarmRows(b);
+	if (next != -1) editorUpdateSyntax(&E.row[next]);
+}
+
+//Cut block b into pieces of KILO_BLOCK_ROWS once it has grown too big
+void editorBlockSplit(int b){
+	int nrows = E.blocks[b].nrows;
+	if (nrows <= 2 * KILO_BLOCK_ROWS) return;
+	int pieces = nrows / KILO_BLOCK_ROWS;
+	E.br_stale = 1;
+	E.blocks = memRealloc(E.blocks, sizeof(struct rowblock) * (E.nblocks + pieces - 1));
+	memmove(&E.blocks[b + pieces], &E.blocks[b + 1], sizeof(struct rowblock) * (E.nblocks - b - 1));
+	int start = E.blocks[b].start;
+	for (int i = 0; i < pieces; i++){
+		struct rowblock *blk = &E.blocks[b + i];
+		//the other pieces' slots still hold copies of the blocks that moved up
+		if (i == 0) editorBlockDropSymbols(blk);
+		blk->syms = NULL;
+		blk->nsyms = 0;
+		blk->cold = 0;
+		blk->start = start + i * KILO_BLOCK_ROWS;
+		//the last piece takes the remainder
+		blk->nrows = (i == pieces - 1) ? nrows - i * KILO_BLOCK_ROWS : KILO_BLOCK_ROWS;
+		editorBlockDirty(b + i);
+	}
+	E.nblocks += pieces - 1;
+}
+
+//n rows are about to be opened at at
+void editorBlocksInsert(int at, int n){
+	if (E.nblocks == 0){
+		E.blocks = memRealloc(E.blocks, sizeof(struct rowblock));
+		E.blocks[0].start = 0;
+		E.blocks[0].nrows = 0;
+		E.blocks[0].offset = 0;
+		E.blocks[0].br_valid = 0;
+		E.blocks[0].syms = NULL;
+		E.blocks[0].nsyms = 0;
+		E.blocks[0].syms_valid = 0;
+		E.blocks[0].cold = 0;
+		E.nblocks = 1;
+		E.offsets_from = 0;
+		E.br_stale = 1;
+	}
+	int b = editorBlockFind(at);
+	//the rows are still where they were, and a split needs every piece's end state
+	editorBlockWarm(b);
+	E.blocks[b].nrows += n;
+	editorBlockDirty(b);
+	for (int i = b + 1; i < E.nblocks; i++) E.blocks[i].start += n;
+	editorBlockSplit(b);
+}
+
+//Rows [at, at+n) are about to be closed
+void editorBlocksRemove(int at, int n){
+	int b = editorBlockFind(at);
+	int keep = b;
+	//a cold block that only loses some of its rows could lose the one that
+	//knows the state it ends in
+	int e = editorBlockFind(at + n - 1);
+	if (at > E.blocks[b].start) editorBlockWarm(b);
+	if (at + n < E.blocks[e].start + E.blocks[e].nrows) editorBlockWarm(e);
+	//blocks from b on shift around, and one may be folded into b - 1
+	if (b - 1 < E.offsets_from) E.offsets_from = b > 0 ? b - 1 : 0;
+	for (int i = b; i < E.nblocks; i++){
+		struct rowblock *blk = &E.blocks[i];
+		int from = at > blk->start ? at : blk->start;
+		int to = at + n < blk->start + blk->nrows ? at + n : blk->start + blk->nrows;
+		if (to > from){
+			blk->nrows -= to - from;
+			blk->valid = 0;
+			blk->sized = 0;
+			editorBracketsDirty(i);
+			blk->syms_valid = 0;
+			if (keep > 0) E.blocks[keep - 1].syms_valid = 0;
+		}
+		blk->start = (blk->start > at + n) ? blk->start - n : (blk->start > at ? at : blk->start);
+		//emptied blocks go, and a block that got small is folded into the one before
+		if (blk->nrows == 0){
+			if (blk->cold) E.cold_blocks--;
+			editorBlockDropSymbols(blk);
+			continue;
+		}
+		if (keep > 0 && blk->nrows < KILO_BLOCK_ROWS / 4 &&
+			E.blocks[keep - 1].nrows + blk->nrows <= 2 * KILO_BLOCK_ROWS){
+			E.blocks[keep - 1].nrows += blk->nrows;
+			E.blocks[keep - 1].valid = 0;
+			E.blocks[keep - 1].sized = 0;
+			E.blocks[keep - 1].br_valid = 0;
+			E.blocks[keep - 1].syms_valid = 0;
+			//warming it redoes all of it, and the last row is blk's either way
+			if (blk->cold && E.blocks[keep - 1].cold) E.cold_blocks--;
+			E.blocks[keep - 1].cold |= blk->cold;
+			editorBlockDropSymbols(blk);
+			continue;
+		}
+		E.blocks[keep++] = *blk;
+	}
+	//blocks went or got folded, so the tree's leaves no longer line up
+	if (keep != E.nblocks) E.br_stale = 1;
+	E.nblocks = keep;
+}
+
+/*** BRACKETS ***/
+
+//Every row knows which of its brackets are left unmatched (see
+//editorRowBrackets), every block folds its rows' summaries together, and a
+//tree over the blocks folds those. Finding the other end of a bracket scans
+//what's left of its row and block, then goes down the tree to the block the
+//match is in, so it doesn't matter how far away that is. All three kinds
+//share one depth, a pair of different kinds counts as unmatched
+
+//Summary of a followed by b
+struct bracketsum bracketJoin(struct bracketsum a, struct bracketsum b){
+	int m = a.open < b.close ? a.open : b.close;
+	struct bracketsum s = {a.open - m + b.open, a.close + b.close - m};
+	return s;
+}
+
+//Block b's summary needs working out again
+void editorBracketsDirty(int b){
+	if (!E.blocks[b].br_valid) return;
+	E.blocks[b].br_valid = 0;
+	//a rebuild redoes every leaf anyway
+	if (E.br_stale) return;
+	if (E.br_ndirty == E.br_cap){
+		E.br_cap = E.br_cap ? E.br_cap * 2 : 16;
+		E.br_dirty = memRealloc(E.br_dirty, sizeof(int) * E.br_cap);
+	}
+	E.br_dirty[E.br_ndirty++] = b;
+}
+
+//Row at's summary changed. Highlighting goes through rows in order, so the
+//block the last one was in is checked before searching
+void editorBracketsChanged(int at){
+	if (E.nblocks == 0) return;
+	int b = E.br_hint;
+	if (b >= E.nblocks || at < E.blocks[b].start || at >= E.blocks[b].start + E.blocks[b].nrows){
+		b = editorBlockFind(at);
+		E.br_hint = b;
+	}
+	editorBracketsDirty(b);
+}
+
+struct bracketsum editorBlockBrackets(int b){
+	struct rowblock *blk = &E.blocks[b];
+	if (!blk->br_valid){
+		editorBlockWarm(b);
+		struct bracketsum s = {0, 0};
+		for (int j = blk->start; j < blk->start + blk->nrows; j++) s = bracketJoin(s, E.row[j].br);
+		blk->br = s;
+		blk->br_valid = 1;
+	}
+	return blk->br;
+}
+
+//Bring the tree up to date: all of it if blocks came or went, otherwise just
+//the paths above the blocks that changed
+void editorBracketsUpdate(){
+	struct bracketsum none = {0, 0};
+	if (E.br_stale){
+		int size = 1;
+		while (size < E.nblocks) size *= 2;
+		if (size != E.br_size){
+			E.br_tree = memRealloc(E.br_tree, sizeof(struct bracketsum) * 2 * size);
+			E.br_size = size;
+		}
+		for (int i = 0; i < size; i++)
+			E.br_tree[size + i] = i < E.nblocks ? editorBlockBrackets(i) : none;
+		for (int i = size - 1; i >= 1; i--)
+			E.br_tree[i] = bracketJoin(E.br_tree[2 * i], E.br_tree[2 * i + 1]);
+		E.br_stale = 0;
+		E.br_ndirty = 0;
+		return;
+	}
+	for (int k = 0; k < E.br_ndirty; k++){
+		int i = E.br_size + E.br_dirty[k];
+		E.br_tree[i] = editorBlockBrackets(E.br_dirty[k]);
+		for (i /= 2; i >= 1; i /= 2)
+			E.br_tree[i] = bracketJoin(E.br_tree[2 * i], E.br_tree[2 * i + 1]);
+	}
+	E.br_ndirty = 0;
+}
+
+//How many brackets of s can close the depth we're at going in direction dir,
+//and how many add to it
+#define BRACKETS_HIT(s, dir) ((dir) > 0 ? (s).close : (s).open)
+#define BRACKETS_PASS(s, dir) ((dir) > 0 ? (s).open : (s).close)
+
+//Walk the render of a row from i in direction dir until the depth *d gets to
+//0, returns where that happened or -1 if it didn't
+int editorRowScanBrackets(erow *row, int i, int dir, int *d){
+	editorRowEnsureDerived(row);
+	unsigned char *hl = editorDecodeHighlight(row);
+	for (; i >= 0 && i < row->rsize; i += dir){
+		char c = row->render[i];
+		if (!bracketOpens(c) && !bracketCloses(c)) continue;
+		if (!bracketCounts(hl[i])) continue;
+		*d += bracketOpens(c) ? dir : -dir;
+		if (*d == 0) return i;
+	}
+	return -1;
+}
+
+//Same over whole rows from from to end (inclusive) using their summaries,
+//returns the row the depth gets to 0 in
+int editorRowsScanBrackets(int from, int end, int dir, int *d){
+	for (int j = from; dir > 0 ? j <= end : j >= end; j += dir){
+		struct bracketsum s = E.row[j].br;
+		if (BRACKETS_HIT(s, dir) >= *d) return j;
+		*d += BRACKETS_PASS(s, dir) - BRACKETS_HIT(s, dir);
+	}
+	return -1;
+}
+
+//The first block past from in direction dir that the depth gets to 0 in,
+//looking under tree node node which covers blocks [lo, hi]
+int editorTreeScanBrackets(int node, int lo, int hi, int from, int dir, int *d){
+	if (dir > 0 ? hi <= from : lo >= from) return -1;
+	struct bracketsum s = E.br_tree[node];
+	//nodes entirely on the far side of from are skipped whole if they can't close it
+	int whole = dir > 0 ? lo > from : hi < from;
+	if (whole && BRACKETS_HIT(s, dir) < *d){
+		*d += BRACKETS_PASS(s, dir) - BRACKETS_HIT(s, dir);
+		return -1;
+	}
+	if (lo == hi) return lo;
+	int mid = (lo + hi) / 2;
+	int found;
+	if (dir > 0){
+		found = editorTreeScanBrackets(2 * node, lo, mid, from, dir, d);
+		if (found < 0) found = editorTreeScanBrackets(2 * node + 1, mid + 1, hi, from, dir, d);
+	}
+	else{
+		found = editorTreeScanBrackets(2 * node + 1, mid + 1, hi, from, dir, d);
+		if (found < 0) found = editorTreeScanBrackets(2 * node, lo, mid, from, dir, d);
+	}
+	return found;
+}
+
+//Find the bracket that pairs with the one at render index rx of row cy.
+//Returns 0 if there's no bracket there or nothing pairs with it
+int editorMatchBracket(int cy, int rx, int *mcy, int *mrx){
+	if (cy < 0 || cy >= E.numrows) return 0;
+	erow *row = &E.row[cy];
+	editorRowEnsureDerived(row);
+	if (rx < 0 || rx >= row->rsize) return 0;
+	char c = row->render[rx];
+	int dir = bracketOpens(c) ? 1 : bracketCloses(c) ? -1 : 0;
+	if (dir == 0 || !bracketCounts(editorDecodeHighlight(row)[rx])) return 0;
+
+	int d = 1;
+	int j = cy;
+	int at = editorRowScanBrackets(row, rx + dir, dir, &d);
+	if (at < 0){
+		editorBracketsUpdate();
+		int b = editorBlockFind(cy);
+		editorBlockWarm(b);
+		struct rowblock *blk = &E.blocks[b];
+		int first = blk->start, last = blk->start + blk->nrows - 1;
+		j = editorRowsScanBrackets(cy + dir, dir > 0 ? last : first, dir, &d);
+		if (j < 0){
+			b = editorTreeScanBrackets(1, 0, E.br_size - 1, b, dir, &d);
+			if (b < 0) return 0;
+			editorBlockWarm(b);
+			blk = &E.blocks[b];
+			first = blk->start;
+			last = blk->start + blk->nrows - 1;
+			j = editorRowsScanBrackets(dir > 0 ? first : last, dir > 0 ? last : first, dir, &d);
+			if (j < 0) return 0;
+		}
+		editorRowEnsureDerived(&E.row[j]);
+		at = editorRowScanBrackets(&E.row[j], dir > 0 ? 0 : E.row[j].rsize - 1, dir, &d);
+		if (at < 0) return 0;
+	}
+	const char *pairs = "()[]{}";
+	char other = pairs[(strchr(pairs, c) - pairs) ^ 1];
+	if (E.row[j].render[at] != other) return 0;
+	*mcy = j;
+	*mrx = at;
+	return 1;
+}
+
+//Chars offset of the character at render index rx, the other way round from
+//editorRowCharsToRender
+int editorRowRenderToChars(erow *row, int rx){
+	if (!(row->flags & ROW_OWNS_RENDER)) return rx;
+	int idx = 0, col = 0, j = 0;
+	while (j < row->size){
+		int n = 1;
+		if (row->chars[j] == '\t'){
+			idx += KILO_TAB_STOP - (col % KILO_TAB_STOP);
+			col += KILO_TAB_STOP - (col % KILO_TAB_STOP);
+		}
+		else{
+			if (row->flags & ROW_ASCII) col++;
+			else col += utf8Width(&row->chars[j], row->size - j, &n);
+			idx += n;
+		}
+		if (idx > rx) return j;
+		j += n;
+	}
+	return j;
+}
+
+//Move the cursor to the other end of the bracket it's on
+void editorJumpBracket(){
+	if (E.cy >= E.numrows) return;
+	erow *row = &E.row[E.cy];
+	int mcy, mrx;
+	if (!editorMatchBracket(E.cy, editorRowCharsToRender(row, E.cx - E.ln_length), &mcy, &mrx)){
+		editorSetStatusMessage("No matching bracket");
+		return;
+	}
+	E.cy = mcy;
+	E.cx = editorRowRenderToChars(&E.row[mcy], mrx) + E.ln_length;
+}
+
+/*** ROW OPERATIONS ***/
+
+//Convert cursor position in the raw string to cursor position in the rendered string
+int editorRowCxToRx(erow *row, int cx){
+	int rx = E.ln_length;
+	int j;
+	if (!(row->flags & ROW_ASCII)){
+		//same thing, but a character can be several bytes and 0-2 columns wide
+		int end = cx - E.ln_length;
+		if (end > row->size) end = row->size;
+		j = 0;
+		while (j < end){
+			int n;
+			if (row->chars[j] == '\t'){
+				rx += KILO_TAB_STOP - ((rx-E.ln_length) % KILO_TAB_STOP);
+				j++;
+				continue;
+			}
+			rx += utf8Width(&row->chars[j], row->size - j, &n);
+			j += n;
+		}
+		return rx;
+	}
+	//Adjust for TABS
+	for (j = E.ln_length; j < cx; j++){
+		if(row->chars[j-E.ln_length] == '\t')
+			rx += (KILO_TAB_STOP - 1) - ((rx-E.ln_length) % KILO_TAB_STOP);
+		rx++;
+	}
+	return rx;
+}
+//Convert cursor position in the rendered string into position in the raw string
+int editorRowRxToCx(erow *row, int rx){
+	int cur_rx = 0;
+	int cx = 0;
+	while (cx < row->size){
+		int n = 1;
+		if (row->chars[cx] == '\t')
+			cur_rx += KILO_TAB_STOP - (cur_rx % KILO_TAB_STOP);
+		else if (row->flags & ROW_ASCII)
+			cur_rx++;
+		else
+			cur_rx += utf8Width(&row->chars[cx], row->size - cx, &n);
+
+		if (cur_rx > rx) return cx;
+		cx += n;
+	}
+	return cx;	
+}
+
+void editorFreeRender(erow *row){
+	if (row->flags & ROW_OWNS_RENDER){
+		memFree(row->render);
+		E.derived_bytes -= row->rsize + 1;
+	}
+	row->flags &= ~(ROW_OWNS_RENDER | ROW_DERIVED);
+	row->render = NULL;
+}
+
+//Do operations on the raw text to get it into the state we want to actually render
+void editorRenderRow(erow *row){
+	int tabs = 0;
+	int j;
+	for (j = 0; j < row->size; j++)
+		if (row->chars[j] == '\t') tabs++;
+	editorFreeRender(row);
+	row->flags |= ROW_DERIVED;
+	if (editorIsAscii(row->chars, row->size)) row->flags |= ROW_ASCII;
+	else row->flags &= ~ROW_ASCII;
+	//Without tabs the render is identical to the raw text, so just share it
+	//(control characters are escaped when drawing, not here)
+	if (tabs == 0){
+		row->render = row->chars;
+		row->rsize = row->size;
+		return;
+	}
+	//Allocate additional memory to render each tab character
+	row->render = memAlloc(row->size + tabs*(KILO_TAB_STOP - 1) + 1);
+	row->flags |= ROW_OWNS_RENDER;
+
+	int idx = 0;
+	//col only differs from idx once we've seen multibyte or wide characters
+	int col = 0;
+	j = 0;
+	while (j < row->size){
+		if(row->chars[j] == '\t'){
+			//Add spaces until we get to a tabstop
+			row->render[idx++] = ' ';
+			col++;
+			while (col % KILO_TAB_STOP != 0){
+				row->render[idx++] = ' ';
+				col++;
+			}
+			j++;
+			continue;
+		}
+		int n = 1;
+		if (row->flags & ROW_ASCII) col++;
+		else col += utf8Width(&row->chars[j], row->size - j, &n);
+		memcpy(&row->render[idx], &row->chars[j], n);
+		idx += n;
+		j += n;
+	}
+	row->render[idx] = '\0';
 	row->rsize = idx;
+	E.derived_bytes += row->rsize + 1;
+}
+
+//This is where every change to chars ends up, so the block's hash is stale
+//now and the words need counting. Rows that only had their render dropped
+//get it back with editorRenderRow, which leaves the indexes alone
+void editorUpdateRender(erow *row){
+	editorBlockInvalidate(row->idx);
+	editorWordsAddRow(row);
+	editorRenderRow(row);
+}
 
+void editorUpdateRow(erow *row){
+	editorUpdateRender(row);
 	editorUpdateSyntax(row);
 }
 
+//Throw away render and hl, only hl_open_comment survives so the row can be
+//highlighted again later without looking at the rows above it
+void editorRowDropDerived(erow *row){
+	editorFreeRender(row);
+	memFree(row->hl);
+	E.derived_bytes -= sizeof(hlspan) * row->hlcount;
+	row->hl = NULL;
+	row->hlcount = 0;
+	row->rsize = 0;
+}
+
+//Called before looking at render/hl of a row that may have been dropped
+void editorRowEnsureDerived(erow *row){
+	if (row->flags & ROW_DERIVED){
+		E.cache_hits++;
+	}
+	else{
+		E.cache_misses++;
+		editorRenderRow(row);
+		editorUpdateSyntax(row);
+	}
+	row->flags |= ROW_REFERENCED;
+}
+
+//Drop derived data until we're back under budget. This is a clock sweep: rows
+//that were drawn or searched since the hand last passed get a second chance,
+//so the ones that go are the least recently displayed
+void editorTrimDerived(){
+	if (E.derived_bytes <= E.derived_budget || E.numrows == 0) return;
+	//Go a bit under budget so we aren't sweeping on every single frame
+	long target = E.derived_budget - E.derived_budget / 4;
+	int sweeps = E.numrows * 2;
+	while (E.derived_bytes > target && sweeps--){
+		if (E.lru_hand >= E.numrows) E.lru_hand = 0;
+		erow *row = &E.row[E.lru_hand++];
+		//never evict what is on screen right now
+		if (editorRowShown(row->idx)) continue;
+		if (row->flags & ROW_REFERENCED){
+			row->flags &= ~ROW_REFERENCED;
+		}
+		else if (row->flags & ROW_DERIVED){
+			editorRowDropDerived(row);
+			E.cache_evictions++;
+		}
+	}
+}
+
+//Make room for n empty rows starting at at. The rows come back with no chars
+//and nothing rendered, it's up to the caller to fill them in
+void editorOpenRows(int at, int n){
+	if (at < 0 || at > E.numrows || n <= 0) return;
+	editorDamage(at);
+	editorBlocksInsert(at, n);
+	//move everything from at onwards down n rows in one go
+	E.row = memRealloc(E.row, sizeof(erow) * (E.numrows + n));
+	memmove(&E.row[at + n], &E.row[at], sizeof(erow) * (E.numrows - at));
+	for (int j = at + n; j < E.numrows + n; j++) E.row[j].idx += n;
+
+	memset(&E.row[at], 0, sizeof(erow) * n);
+	for (int j = at; j < at + n; j++) E.row[j].idx = j;
+	E.numrows += n;
+}
+
+void editorFreeRow(erow *row){
+	if (row->flags & ROW_STALE) E.stale_rows--;
+	editorWordsRemoveRow(row);
+	editorRowDropDerived(row);
+	rowTextRelease(row->chars);
+}
+
+//Free rows [at, at+n) and close up the gap they leave in one move
+void editorCloseRows(int at, int n){
+	if (at < 0 || at >= E.numrows || n <= 0) return;
+	if (at + n > E.numrows) n = E.numrows - at;
+	editorDamage(at);
+	editorBlocksRemove(at, n);
+	for (int j = at; j < at + n; j++) editorFreeRow(&E.row[j]);
+	memmove(&E.row[at], &E.row[at + n], sizeof(erow) * (E.numrows - at - n));
+	for (int j = at; j < E.numrows - n; j++) E.row[j].idx -= n;
+	E.numrows -= n;
+}
+
+//Re-render and highlight rows [from, to] after a bulk change. Each row only
+//gets highlighted once, then the row after the range is redone in case the
+//comment state coming out of the range is different now
+void editorUpdateRows(int from, int to){
+	unsigned long long start = nowNanos();
+	//warming a cold block can leave a row further on to be redone
+	int pending = -1;
+	for (int j = from; j <= to && j < E.numrows; j++){
+		editorUpdateRender(&E.row[j]);
+		int next = editorHighlightRow(&E.row[j]);
+		if (next > to + 1) pending = next;
+		//a big enough range would blow through the cache budget otherwise
+		if ((j - from) % 4096 == 4095) editorTrimDerived();
+	}
+	editorPhaseEnd(PH_SYNTAX, start);
+	if (to + 1 < E.numrows) editorUpdateSyntax(&E.row[to + 1]);
+	if (pending != -1) editorUpdateSyntax(&E.row[pending]);
+}
+
 void editorInsertRow(int at, char *s, size_t len){
 	if (at < 0 || at > E.numrows) return;
-	//move what's on the current row to the next one
-	E.row = realloc(E.row, sizeof(erow) * (E.numrows + 1));
-	memmove(&E.row[at + 1], &E.row[at], sizeof(erow) * (E.numrows - at));
-	for (int j = at + 1; j <= E.numrows; j++) E.row[j].idx++;
-
-	E.row[at].idx = at;
+	editorOpenRows(at, 1);
 
 	//copy the chars of s into the erow
 	E.row[at].size = len;
-	E.row[at].chars = malloc(len+1);
+	E.row[at].chars = rowTextAlloc(len);
 	memcpy(E.row[at].chars, s, len);
 	E.row[at].chars[len] = '\0';
 	//update row for rendering
-	E.row[at].rsize = 0;
-	E.row[at].render = NULL;
-	E.row[at].hl = NULL;
-	E.row[at].hl_open_comment = 0;
 	editorUpdateRow(&E.row[at]);
-
-	E.numrows++;
 	E.dirty++;
 }
 
-void editorFreeRow(erow *row){
-	free(row->render);
-	free(row->chars);
-	free(row->hl);
-}
-
 //remove memory for a row if we backspace at the beginning of a line
 void editorDelRow(int at){
 	if (at < 0 || at >= E.numrows) return;
-	editorFreeRow(&E.row[at]);
-	memmove(&E.row[at], &E.row[at + 1], sizeof(erow) * (E.numrows - at - 1));
-	for (int j = at; j < E.numrows - 1; j++) E.row[j].idx--;
-	E.numrows--;
+	editorCloseRows(at, 1);
+	E.dirty++;
+}
+
+//Replace the text from (r0, c0) up to (r1, c1) with len bytes of s, which can
+//have newlines in it. Columns are byte offsets into chars. However many rows
+//this adds or removes, E.row only gets moved once, and the changed rows only
+//get highlighted once
+void editorReplaceRange(int r0, int c0, int r1, int c1, const char *s, int len){
+	if (r0 < 0 || r1 >= E.numrows || r1 < r0) return;
+	if (c0 > E.row[r0].size) c0 = E.row[r0].size;
+	if (c1 > E.row[r1].size) c1 = E.row[r1].size;
+	if (r0 == r1 && c1 < c0) c1 = c0;
+
+	int lines = 1;
+	for (int i = 0; i < len; i++)
+		if (s[i] == '\n') lines++;
+
+	//hang on to what comes after the range, row r1 might be about to go away
+	int suffixlen = E.row[r1].size - c1;
+	char *suffix = memAlloc(suffixlen + 1);
+	memcpy(suffix, &E.row[r1].chars[c1], suffixlen);
+
+	int oldrows = r1 - r0 + 1;
+	if (lines > oldrows) editorOpenRows(r1 + 1, lines - oldrows);
+	else if (lines < oldrows) editorCloseRows(r0 + lines, oldrows - lines);
+
+	//Rows r0 .. r0+lines-1 get the new lines, the first keeps what was before c0
+	//and the last gets the suffix stuck on the end
+	const char *p = s;
+	const char *end = s + len;
+	for (int i = 0; i < lines; i++){
+		erow *row = &E.row[r0 + i];
+		const char *nl = memchr(p, '\n', end - p);
+		if (!nl) nl = end;
+		int linelen = nl - p;
+		int pre = (i == 0) ? c0 : 0;
+		int suf = (i == lines - 1) ? suffixlen : 0;
+
+		char *chars = rowTextAlloc(pre + linelen + suf);
+		memcpy(chars, row->chars, pre);
+		memcpy(chars + pre, p, linelen);
+		memcpy(chars + pre + linelen, suffix, suf);
+		chars[pre + linelen + suf] = '\0';
+		editorWordsRemoveRow(row);
+		rowTextRelease(row->chars);
+		row->chars = chars;
+		row->size = pre + linelen + suf;
+		p = nl + 1;
+	}
+	memFree(suffix);
+
+	editorUpdateRows(r0, r0 + lines - 1);
 	E.dirty++;
 }
 
+//Like editorReplaceRange with an empty range, but the text comes as slices,
+//one per line. A line that is exactly one whole slice just shares the slice's
+//text, so pasting lines doesn't copy them
+void editorInsertSlices(int r, int c, struct slice *sl, int n){
+	if (r < 0 || r >= E.numrows || n <= 0) return;
+	if (c > E.row[r].size) c = E.row[r].size;
+
+	int suffixlen = E.row[r].size - c;
+	char *suffix = memAlloc(suffixlen + 1);
+	memcpy(suffix, &E.row[r].chars[c], suffixlen);
+
+	editorOpenRows(r + 1, n - 1);
+	for (int i = 0; i < n; i++){
+		erow *row = &E.row[r + i];
+		int pre = (i == 0) ? c : 0;
+		int suf = (i == n - 1) ? suffixlen : 0;
+		char *chars;
+		if (pre == 0 && suf == 0 && sl[i].full){
+			chars = rowTextRetain(sl[i].text);
+		}
+		else{
+			chars = rowTextAlloc(pre + sl[i].len + suf);
+			if (pre) memcpy(chars, row->chars, pre);
+			memcpy(chars + pre, sl[i].text + sl[i].off, sl[i].len);
+			memcpy(chars + pre + sl[i].len, suffix, suf);
+			chars[pre + sl[i].len + suf] = '\0';
+		}
+		editorWordsRemoveRow(row);
+		rowTextRelease(row->chars);
+		row->chars = chars;
+		row->size = pre + sl[i].len + suf;
+	}
+	memFree(suffix);
+
+	editorUpdateRows(r, r + n - 1);
+	E.dirty++;
+}
+
+//Rows being built from text that arrives a piece at a time (a filter's output,
+//a reloaded file), plus the unfinished last line
+struct newRows {
+	erow *rows;
+	int n;
+	int cap;
+	char *partial;
+	int plen;
+	int pcap;
+};
+
+void newRowsAdd(struct newRows *out, char *s, int len){
+	if (len > 0 && s[len - 1] == '\r') len--;
+	if (out->n == out->cap){
+		out->cap = out->cap ? out->cap * 2 : 256;
+		out->rows = memRealloc(out->rows, sizeof(erow) * out->cap);
+	}
+	erow *row = &out->rows[out->n++];
+	row->chars = rowTextAlloc(len);
+	memcpy(row->chars, s, len);
+	row->chars[len] = '\0';
+	row->size = len;
+}
+
+void newRowsAddPartial(struct newRows *out, char *s, int len){
+	if (out->plen + len > out->pcap){
+		out->pcap = (out->plen + len) * 2;
+		out->partial = memRealloc(out->partial, out->pcap);
+	}
+	memcpy(&out->partial[out->plen], s, len);
+	out->plen += len;
+}
+
+//Turn every complete line in buf into a row, holding on to whatever comes after
+//the last newline until the rest of it shows up (or the output ends)
+void newRowsTakeLines(struct newRows *out, char *buf, int len){
+	char *p = buf;
+	char *end = buf + len;
+	while (p < end){
+		char *nl = memchr(p, '\n', end - p);
+		if (!nl){
+			newRowsAddPartial(out, p, end - p);
+			break;
+		}
+		if (out->plen){
+			newRowsAddPartial(out, p, nl - p);
+			newRowsAdd(out, out->partial, out->plen);
+			out->plen = 0;
+		}
+		else{
+			newRowsAdd(out, p, nl - p);
+		}
+		p = nl + 1;
+	}
+}
+
+//Whatever's left over is the last line, it just didn't end in a newline
+void newRowsFinish(struct newRows *nr){
+	if (nr->plen) newRowsAdd(nr, nr->partial, nr->plen);
+	memFree(nr->partial);
+	nr->partial = NULL;
+	nr->plen = 0;
+}
+
+void newRowsFree(struct newRows *nr){
+	for (int i = 0; i < nr->n; i++) rowTextRelease(nr->rows[i].chars);
+	memFree(nr->rows);
+	memFree(nr->partial);
+}
+
+//Replace the old rows starting at at with the new ones in one go, then
+//render and highlight them
+void editorSpliceRows(int at, int old, struct newRows *nr){
+	editorCloseRows(at, old);
+	editorOpenRows(at, nr->n);
+	for (int i = 0; i < nr->n; i++){
+		E.row[at + i].chars = nr->rows[i].chars;
+		E.row[at + i].size = nr->rows[i].size;
+	}
+	memFree(nr->rows);
+	if (nr->n > 0) editorUpdateRows(at, at + nr->n - 1);
+	else if (at < E.numrows) editorUpdateSyntax(&E.row[at]);
+}
+
 //Insert character into the erow and allocate new memory
 void editorRowInsertChar(erow *row, int at, int c){
 	if (at < 0 || at > row->size) at = row->size;
-	row->chars = realloc(row->chars, row->size + 2);
+	editorRowReserve(row, row->size + 1);
 	memmove(&row->chars[at+1], &row->chars[at], row->size - at + 1);
 	row->size++;
 	row->chars[at] = c;
@@ -520,7 +2456,7 @@ void editorRowInsertChar(erow *row, int at, int c){
 
 //Append multiple characters to the end of a row
 void editorRowAppendString(erow *row, char *s, size_t len){
-	row->chars = realloc(row->chars, row->size + len + 1);
+	editorRowReserve(row, row->size + len);
 	memcpy(&row->chars[row->size], s, len);
 	row->size += len;
 	row->chars[row->size] = '\0';
@@ -528,11 +2464,14 @@ void editorRowAppendString(erow *row, char *s, size_t len){
 	E.dirty++;
 }
 
-//Delete character and update the size of the erow
+//Delete the character starting at at (all of its bytes) and update the size of the erow
 void editorRowDelChar(erow *row, int at){
 	if (at < 0 || at >= row->size) return;
-	memmove(&row->chars[at], &row->chars[at+1], row->size - at);
-	row->size--;
+	int n = 1;
+	if (!(row->flags & ROW_ASCII)) n = utf8Next(row->chars, row->size, at) - at;
+	editorRowReserve(row, row->size);
+	memmove(&row->chars[at], &row->chars[at+n], row->size - at - n + 1);
+	row->size -= n;
 	editorUpdateRow(row);
 	E.dirty++;
 }
@@ -548,6 +2487,25 @@ void editorInsertChar(int c){
 	E.cx++;
 }
 
+//The terminal sends multibyte characters a byte at a time, grab the rest of
+//the sequence so the row never has half a character in it when we redraw
+void editorInsertUtf8(int lead){
+	int n = 1;
+	if (lead >= 0xc0 && lead < 0xe0) n = 2;
+	else if (lead >= 0xe0 && lead < 0xf0) n = 3;
+	else if (lead >= 0xf0 && lead < 0xf8) n = 4;
+	editorInsertChar(lead);
+	while (--n > 0){
+		int c = editorReadKey();
+		if (c < 0x80 || c >= 0xc0){
+			//not a continuation after all, treat it as its own key
+			if (c < 256) editorInsertChar(c);
+			return;
+		}
+		editorInsertChar(c);
+	}
+}
+
 //
 void editorInsertNewline(){
 	//if we're at the beginning of the row, just insert a row where you are
@@ -560,6 +2518,7 @@ void editorInsertNewline(){
 		editorInsertRow(E.cy + 1, &row->chars[E.cx - E.ln_length], row->size - (E.cx - E.ln_length));
 		//inserting calls realloc() which might move memory around, so reassign row
 		row = &E.row[E.cy];
+		editorRowReserve(row, E.cx - E.ln_length);
 		row->size = E.cx - E.ln_length;
 		row->chars[row->size] = '\0';
 		editorUpdateRow(row);
@@ -568,6 +2527,61 @@ void editorInsertNewline(){
 	E.cx = E.ln_length;
 }
 
+//Insert text (possibly several lines of it) at the cursor and leave the
+//cursor at the end of it
+void editorInsertText(const char *s, int len){
+	if (E.cy == E.numrows){
+		editorInsertRow(E.numrows, "", 0);
+	}
+	int at = E.cx - E.ln_length;
+	int rowsafter = E.numrows - E.cy;
+	int tail = E.row[E.cy].size - at;
+	editorReplaceRange(E.cy, at, E.cy, at, s, len);
+	//whatever was after the cursor is now at the end of the last inserted line
+	E.cy = E.numrows - rowsafter;
+	E.cx = E.row[E.cy].size - tail + E.ln_length;
+}
+
+//Delete n whole lines starting at the cursor's
+void editorDeleteLines(int n){
+	if (E.cy >= E.numrows) return;
+	if (n > E.numrows - E.cy) n = E.numrows - E.cy;
+	editorCloseRows(E.cy, n);
+	//the row that moved up to cy now has a different row above it
+	if (E.cy < E.numrows) editorUpdateSyntax(&E.row[E.cy]);
+	E.dirty++;
+	E.cx = E.ln_length;
+	editorSetStatusMessage("%d line%s deleted", n, n == 1 ? "" : "s");
+}
+
+//Join n lines (at least two) starting at the cursor's into one, with a space
+//in place of each line break and leading whitespace taken off the joined lines
+void editorJoinLines(int n){
+	if (n < 2) n = 2;
+	if (E.cy >= E.numrows - 1) return;
+	if (n > E.numrows - E.cy) n = E.numrows - E.cy;
+
+	int last = E.cy + n - 1;
+	int len = 0;
+	for (int j = E.cy + 1; j <= last; j++) len += E.row[j].size + 1;
+	char *joined = memAlloc(len + 1);
+	len = 0;
+	int joinpoint = 0;
+	for (int j = E.cy + 1; j <= last; j++){
+		char *chars = E.row[j].chars;
+		int skip = 0;
+		while (skip < E.row[j].size && isspace((unsigned char)chars[skip])) skip++;
+		joinpoint = E.row[E.cy].size + len;
+		joined[len++] = ' ';
+		memcpy(&joined[len], &chars[skip], E.row[j].size - skip);
+		len += E.row[j].size - skip;
+	}
+	editorReplaceRange(E.cy, E.row[E.cy].size, last, E.row[last].size, joined, len);
+	memFree(joined);
+	//like vim, leave the cursor where the last join happened
+	E.cx = joinpoint + E.ln_length;
+}
+
 //Call the row operation for deletion and move the cursor
 void editorDelChar(){
 	//dont do anything if past the end of the file
@@ -578,8 +2592,11 @@ void editorDelChar(){
 	erow *row = &E.row[E.cy];
 	//delete character if not on the first character of the row
 	if (E.cx > E.ln_length){
-		editorRowDelChar(row, E.cx - E.ln_length - 1);
-		E.cx--;
+		int at = E.cx - E.ln_length - 1;
+		if (!(row->flags & ROW_ASCII)) at = utf8Prev(row->chars, row->size, E.cx - E.ln_length);
+		int oldsize = row->size;
+		editorRowDelChar(row, at);
+		E.cx -= oldsize - row->size;
 	}
 	//delete row if on the first character of the row
 	else {
@@ -590,19 +2607,104 @@ void editorDelChar(){
 	}
 }
 
-/*** FILE I/0 ***/
+/*** SELECTION AND REGISTERS ***/
+
+//Get the selection as (r0, c0) up to (r1, c1) in chars offsets, in order.
+//Returns 0 if there isn't one
+int editorSelection(int *r0, int *c0, int *r1, int *c1){
+	if (!E.mark_set || E.numrows == 0) return 0;
+	int ay = E.mark_cy, ax = E.mark_cx - E.ln_length;
+	int by = E.cy, bx = E.cx - E.ln_length;
+	if (ay > by || (ay == by && ax > bx)){
+		int t = ay; ay = by; by = t;
+		t = ax; ax = bx; bx = t;
+	}
+	//the cursor can sit on the line after the last one
+	if (ay >= E.numrows) return 0;
+	if (by >= E.numrows){
+		by = E.numrows - 1;
+		bx = E.row[by].size;
+	}
+	if (ax > E.row[ay].size) ax = E.row[ay].size;
+	if (bx > E.row[by].size) bx = E.row[by].size;
+	*r0 = ay; *c0 = ax < 0 ? 0 : ax;
+	*r1 = by; *c1 = bx < 0 ? 0 : bx;
+	return 1;
+}
 
-char *editorRowsToString(int *buflen){
-	//totlen is the total number of characters in the file
-	int totlen = 0;
-	int j;
-	for (j = 0; j < E.numrows; j++)
-		totlen += E.row[j].size + 1;
-	*buflen = totlen;
-	//allocate enough memory for the entire file
-	char* buf = malloc(totlen);
-	char *p = buf;
-	//copy each line, move the pointer and add a newline
+void editorRegisterClear(struct editorRegister *reg){
+	for (int i = 0; i < reg->count; i++) rowTextRelease(reg->slices[i].text);
+	memFree(reg->slices);
+	reg->slices = NULL;
+	reg->count = 0;
+}
+
+//Put the selection in the register. This only takes a reference to each
+//row's text, nothing gets copied until one side or the other changes it
+int editorCopySelection(){
+	int r0, c0, r1, c1;
+	if (!editorSelection(&r0, &c0, &r1, &c1)){
+		editorSetStatusMessage("Nothing selected (Ctrl-B sets the mark)");
+		return 0;
+	}
+	editorRegisterClear(&E.reg);
+	E.reg.count = r1 - r0 + 1;
+	E.reg.slices = memAlloc(sizeof(struct slice) * E.reg.count);
+	for (int j = r0; j <= r1; j++){
+		erow *row = &E.row[j];
+		struct slice *sl = &E.reg.slices[j - r0];
+		int from = (j == r0) ? c0 : 0;
+		int to = (j == r1) ? c1 : row->size;
+		sl->text = rowTextRetain(row->chars);
+		sl->off = from;
+		sl->len = to - from;
+		sl->full = (from == 0 && to == row->size);
+	}
+	E.mark_set = 0;
+	editorSetStatusMessage("%d line%s copied", E.reg.count, E.reg.count == 1 ? "" : "s");
+	return 1;
+}
+
+void editorCutSelection(){
+	int r0, c0, r1, c1;
+	if (!editorSelection(&r0, &c0, &r1, &c1) || !editorCopySelection()) return;
+	editorReplaceRange(r0, c0, r1, c1, "", 0);
+	E.cy = r0;
+	E.cx = c0 + E.ln_length;
+	editorSetStatusMessage("%d line%s cut", E.reg.count, E.reg.count == 1 ? "" : "s");
+}
+
+//Paste the register at the cursor, count times over
+void editorPaste(int count){
+	if (E.reg.count == 0){
+		editorSetStatusMessage("Nothing to paste");
+		return;
+	}
+	if (E.cy == E.numrows) editorInsertRow(E.numrows, "", 0);
+	while (count--){
+		int at = E.cx - E.ln_length;
+		int tail = E.row[E.cy].size - at;
+		editorInsertSlices(E.cy, at, E.reg.slices, E.reg.count);
+		//leave the cursor after what was pasted, ready for the next one
+		E.cy += E.reg.count - 1;
+		E.cx = E.row[E.cy].size - tail + E.ln_length;
+	}
+	E.mark_set = 0;
+}
+
+/*** FILE I/0 ***/
+
+char *editorRowsToString(int *buflen){
+	//totlen is the total number of characters in the file
+	int totlen = 0;
+	int j;
+	for (j = 0; j < E.numrows; j++)
+		totlen += E.row[j].size + 1;
+	*buflen = totlen;
+	//allocate enough memory for the entire file
+	char* buf = memAlloc(totlen);
+	char *p = buf;
+	//copy each line, move the pointer and add a newline
 	for (j = 0; j < E.numrows; j++){
 		memcpy(p, E.row[j].chars, E.row[j].size);
 		p += E.row[j].size;
@@ -616,31 +2718,32 @@ char *editorRowsToString(int *buflen){
 //Open and read a file from disc. Only called if program run supplied with args
 void editorOpen(char *filename){
 	//Add the input file name to the editorConfig
-	free(E.filename);
-	E.filename = strdup(filename);
+	memFree(E.filename);
+	E.filename = memStrdup(filename);
 
-	editorSelectSyntaxHighlight();
+	if (editorFileIsBinary(filename)){
+		if (editorHexOpen(filename) == -1) die("open");
+		editorWatchFile();
+		return;
+	}
 
-	//Look for file with provided filename
-	FILE *fp = fopen(filename, "r");
-	if (!fp) die("fopen");
+	editorSelectSyntaxHighlight();
 
-	char *line = NULL;
-	size_t linecap = 0;
-	ssize_t linelen;
-	//Look at each line and copy its contents to our editorConfig struct 
-	while ((linelen = getline(&line, &linecap, fp)) != -1){
-		while(linelen > 0 && (line[linelen-1] == '\n'|| line[linelen-1] == '\r')){
-			linelen--;
-		}
-		editorInsertRow(E.numrows, line, linelen);
-	}
-	free(line);
-	fclose(fp);
-	E.dirty = 0;
+	//read the way buffers are, so a big file can come from its open cache and a
+	//compressed one comes in through its decompressor
+	if (editorLoadFile(filename) == -1) die("open");
+	editorWatchFile();
 }
 
 void editorSave(){
+	if (E.hex){
+		editorHexSave();
+		return;
+	}
+	if (E.compress && E.filename){
+		editorSaveCompressed();
+		return;
+	}
 	if (E.filename == NULL){
 		E.filename = editorPrompt("Save as: %s (ESC to cancel)", NULL);
 		if (E.filename == NULL){
@@ -648,6 +2751,7 @@ void editorSave(){
 			return;
 		}
 		editorSelectSyntaxHighlight();
+		editorWatchFile();
 	}
 
 	int len;
@@ -657,8 +2761,11 @@ void editorSave(){
 	if (fd != -1) {
 		if (ftruncate(fd, len) != -1){
 			if(write(fd, buf, len) == len){
+				//so the watch can tell this write apart from someone else's
+				fstat(fd, &E.file_stat);
 				close(fd);
-				free(buf);
+				editorCacheSave(E.filename, &E.file_stat, buf);
+				memFree(buf);
 				E.dirty = 0;
 				editorSetStatusMessage("%d bytes written to disk", len);
 				return;
@@ -666,88 +2773,2798 @@ void editorSave(){
 		}
 		close(fd);
 	}
-	free(buf);
-	editorSetStatusMessage("Can't save! I/0 error: %s", strerror(errno));
+	memFree(buf);
+	editorSetStatusMessage("Can't save! I/0 error: %s", strerror(errno));
+}
+
+/*** FILE WATCHING ***/
+
+//Watch the directory rather than the file itself, so the file being replaced
+//by a rename (how most programs save) is seen too
+void editorWatchFile(){
+	if (E.filename == NULL) return;
+	if (E.watch_fd == -1) E.watch_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	if (E.watch_fd == -1) return;
+	if (E.watch_wd != -1) inotify_rm_watch(E.watch_fd, E.watch_wd);
+	char dir[strlen(E.filename) + 2];
+	char *slash = strrchr(E.filename, '/');
+	if (slash) snprintf(dir, sizeof(dir), "%.*s", (int)(slash - E.filename + 1), E.filename);
+	else strcpy(dir, ".");
+	uint32_t mask = IN_CLOSE_WRITE | IN_MOVED_TO;
+	//following wants to hear about every write, and a log being recreated
+	if (E.follow_fd != -1) mask |= IN_MODIFY | IN_CREATE;
+	E.watch_wd = inotify_add_watch(E.watch_fd, dir, mask);
+}
+
+int editorStatChanged(struct stat *st){
+	return st->st_ino != E.file_stat.st_ino || st->st_dev != E.file_stat.st_dev ||
+		st->st_size != E.file_stat.st_size ||
+		st->st_mtim.tv_sec != E.file_stat.st_mtim.tv_sec ||
+		st->st_mtim.tv_nsec != E.file_stat.st_mtim.tv_nsec;
+}
+
+//Does block b hold exactly the len bytes at p?
+int editorBlockMatches(int b, char *p, long len){
+	editorBlockRefresh(b);
+	return E.blocks[b].bytes <= len && blockHashBytes(p, E.blocks[b].bytes) == E.blocks[b].hash;
+}
+
+//Hashes of a run of lines, with a table to find the next line with a given hash
+struct lineIndex {
+	uint64_t *hash;
+	int *next;
+	int *table;
+	int mask;
+	int n;
+};
+
+//Lines only have to hash alike this many in a row before the diff trusts a match
+#define DIFF_RUN 3
+//and it gives up following chains of repeated lines after this many
+#define DIFF_CHAIN 64
+
+void lineIndexBuild(struct lineIndex *li, uint64_t *hash, int n){
+	li->hash = hash;
+	li->n = n;
+	int size = 16;
+	while (size < n * 2) size *= 2;
+	li->mask = size - 1;
+	li->table = memAlloc(sizeof(int) * size);
+	li->next = memAlloc(sizeof(int) * (n ? n : 1));
+	memset(li->table, -1, sizeof(int) * size);
+	//going backwards leaves each chain in increasing order
+	for (int k = n - 1; k >= 0; k--){
+		int slot = hash[k] & li->mask;
+		while (li->table[slot] != -1 && hash[li->table[slot]] != hash[k]) slot = (slot + 1) & li->mask;
+		li->next[k] = li->table[slot];
+		li->table[slot] = k;
+	}
+}
+
+//First line at or after from with hash h that starts a run of DIFF_RUN lines
+//matching the ones at other[at], or -1
+int lineIndexFind(struct lineIndex *li, uint64_t h, int from, uint64_t *other, int at, int othern){
+	int slot = h & li->mask;
+	while (li->table[slot] != -1 && li->hash[li->table[slot]] != h) slot = (slot + 1) & li->mask;
+	int steps = 0;
+	for (int k = li->table[slot]; k != -1 && steps < DIFF_CHAIN; k = li->next[k], steps++){
+		if (k < from) continue;
+		int run = 1;
+		while (run < DIFF_RUN && k + run < li->n && at + run < othern &&
+			li->hash[k + run] == other[at + run]) run++;
+		if (run == DIFF_RUN || k + run == li->n || at + run == othern) return k;
+	}
+	return -1;
+}
+
+void lineIndexFree(struct lineIndex *li){
+	memFree(li->table);
+	memFree(li->next);
+}
+
+//A stretch of old rows to be swapped for a stretch of new lines
+struct hunk {
+	int a, alen;
+	int b, blen;
+};
+
+//Bring the buffer up to date with what's on disk now. Whole blocks that still
+//match are skipped from both ends by hash, then the rows and lines in between
+//are diffed greedily and only the hunks that differ are parsed and spliced in,
+//so the work done after reading the file goes with the size of the change. The
+//cursor and scroll position stay on the same text
+void editorReloadFile(){
+	//the mapping already has whatever was changed in place, only its size can
+	//be out of date
+	if (E.hex){
+		editorHexReload();
+		return;
+	}
+	int fd = open(E.filename, O_RDONLY);
+	//in the middle of being replaced, there'll be another event when it's back
+	if (fd == -1) return;
+	struct stat st;
+	if (fstat(fd, &st) == -1 || !editorStatChanged(&st)){
+		close(fd);
+		return;
+	}
+	if (E.dirty){
+		close(fd);
+		E.file_stat = st;
+		editorSetStatusMessage("%s changed on disk, not reloading over unsaved changes", E.filename);
+		return;
+	}
+	unsigned long long start = nowNanos();
+	//there's no text to line up against the rows without decompressing all
+	//of it, so a compressed file is read again whole
+	E.compress = editorFileCompression(fd);
+	if (E.compress){
+		struct newRows nr = {0};
+		int ok = editorDecompress(fd, E.compress, &nr);
+		close(fd);
+		E.file_stat = st;
+		if (ok == -1){
+			editorSetStatusMessage("%s changed on disk, can't read it again: %s", E.filename, strerror(errno));
+			return;
+		}
+		int n = nr.n;
+		editorSpliceRows(0, E.numrows, &nr);
+		if (E.cy > E.numrows) E.cy = E.numrows;
+		if (E.cy < E.numrows && E.cx - E.ln_length > E.row[E.cy].size)
+			E.cx = E.row[E.cy].size + E.ln_length;
+		E.mark_set = 0;
+		E.dirty = 0;
+		editorSetStatusMessage("%s changed on disk, reloaded %d line%s in %.1f ms", E.filename,
+			n, n == 1 ? "" : "s", (nowNanos() - start) / 1e6);
+		return;
+	}
+	long size = st.st_size;
+	char *data = "";
+	if (size > 0){
+		data = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (data == MAP_FAILED){
+			close(fd);
+			return;
+		}
+	}
+	close(fd);
+
+	//blocks that are the same at the start and end of the file
+	long off = 0, end = size;
+	int b = 0, e = E.nblocks - 1;
+	while (b < E.nblocks && editorBlockMatches(b, data + off, end - off)){
+		off += E.blocks[b].bytes;
+		b++;
+	}
+	while (e >= b){
+		editorBlockRefresh(e);
+		long bytes = E.blocks[e].bytes;
+		if (bytes > end - off || !editorBlockMatches(e, data + end - bytes, bytes)) break;
+		end -= bytes;
+		e--;
+	}
+	int rfrom = (b < E.nblocks) ? E.blocks[b].start : E.numrows;
+	int rto = (e >= b) ? E.blocks[e].start + E.blocks[e].nrows : rfrom;
+
+	//split what's left of the file into lines the same way editorOpen would
+	int na = rto - rfrom;
+	int nb = 0, bcap = 256;
+	long *boff = memAlloc(sizeof(long) * bcap);
+	int *blen = memAlloc(sizeof(int) * bcap);
+	for (long p = off; p < end; ){
+		char *nl = memchr(data + p, '\n', end - p);
+		long stop = nl ? nl - data : end;
+		int len = stop - p;
+		while (len > 0 && data[p + len - 1] == '\r') len--;
+		if (nb == bcap){
+			bcap *= 2;
+			boff = memRealloc(boff, sizeof(long) * bcap);
+			blen = memRealloc(blen, sizeof(int) * bcap);
+		}
+		boff[nb] = p;
+		blen[nb++] = len;
+		p = stop + 1;
+	}
+	uint64_t *ha = memAlloc(sizeof(uint64_t) * (na ? na : 1));
+	uint64_t *hb = memAlloc(sizeof(uint64_t) * (nb ? nb : 1));
+	for (int i = 0; i < na; i++) ha[i] = blockHashBytes(E.row[rfrom + i].chars, E.row[rfrom + i].size);
+	for (int j = 0; j < nb; j++) hb[j] = blockHashBytes(data + boff[j], blen[j]);
+	struct lineIndex ia, ib;
+	lineIndexBuild(&ia, ha, na);
+	lineIndexBuild(&ib, hb, nb);
+
+	//walk both sides, on a mismatch skip ahead on whichever side gets back in
+	//step soonest (or call it a changed line if neither does)
+	struct hunk *hunks = NULL;
+	int nhunks = 0, hcap = 0;
+	int i = 0, j = 0, hi = -1, hj = -1;
+	while (i < na || j < nb){
+		erow *row = i < na ? &E.row[rfrom + i] : NULL;
+		int same = row && j < nb && ha[i] == hb[j] && row->size == blen[j] &&
+			!memcmp(row->chars, data + boff[j], blen[j]);
+		if (same){
+			if (hi != -1){
+				if (nhunks == hcap){
+					hcap = hcap ? hcap * 2 : 16;
+					hunks = memRealloc(hunks, sizeof(struct hunk) * hcap);
+				}
+				hunks[nhunks++] = (struct hunk){ hi, i - hi, hj, j - hj };
+				hi = -1;
+			}
+			i++;
+			j++;
+			continue;
+		}
+		if (hi == -1){
+			hi = i;
+			hj = j;
+		}
+		int jb = (i < na) ? lineIndexFind(&ib, ha[i], j, ha, i, na) : -1;
+		int ib2 = (j < nb) ? lineIndexFind(&ia, hb[j], i, hb, j, nb) : -1;
+		if (i < na && jb != -1 && (ib2 == -1 || jb - j <= ib2 - i)) j = jb;
+		else if (j < nb && ib2 != -1) i = ib2;
+		else{
+			if (i < na) i++;
+			if (j < nb) j++;
+		}
+	}
+	if (hi != -1){
+		if (nhunks == hcap){
+			hcap = hcap ? hcap * 2 : 16;
+			hunks = memRealloc(hunks, sizeof(struct hunk) * hcap);
+		}
+		hunks[nhunks++] = (struct hunk){ hi, na - hi, hj, nb - hj };
+	}
+
+	//apply from the bottom up so the rows above each hunk haven't moved yet
+	int changed = 0;
+	for (int h = nhunks - 1; h >= 0; h--){
+		struct hunk *hk = &hunks[h];
+		struct newRows nr = {0};
+		for (int k = hk->b; k < hk->b + hk->blen; k++) newRowsAdd(&nr, data + boff[k], blen[k]);
+		int at = rfrom + hk->a;
+		int delta = hk->blen - hk->alen;
+		editorSpliceRows(at, hk->alen, &nr);
+		changed += hk->alen > hk->blen ? hk->alen : hk->blen;
+		//keep looking at the same text
+		if (E.cy >= at + hk->alen) E.cy += delta;
+		if (E.rowoff >= at + hk->alen) E.rowoff += delta;
+		if (E.mark_cy >= at + hk->alen) E.mark_cy += delta;
+	}
+	if (E.cy > E.numrows) E.cy = E.numrows;
+	if (E.cy < E.numrows && E.cx - E.ln_length > E.row[E.cy].size)
+		E.cx = E.row[E.cy].size + E.ln_length;
+	int r0, c0, r1, c1;
+	if (E.mark_set && !editorSelection(&r0, &c0, &r1, &c1)) E.mark_set = 0;
+
+	memFree(hunks);
+	lineIndexFree(&ia);
+	lineIndexFree(&ib);
+	memFree(ha);
+	memFree(hb);
+	memFree(boff);
+	memFree(blen);
+	if (size > 0) munmap(data, size);
+	E.file_stat = st;
+	E.dirty = 0;
+	editorSetStatusMessage("%s changed on disk, reloaded %d line%s in %.1f ms", E.filename,
+		changed, changed == 1 ? "" : "s", (nowNanos() - start) / 1e6);
+}
+
+//Read what inotify has for us. Returns 1 if the buffer was reloaded
+int editorWatchEvents(){
+	char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+	char *slash = E.filename ? strrchr(E.filename, '/') : NULL;
+	char *base = slash ? slash + 1 : E.filename;
+	int ours = 0;
+	ssize_t len;
+	while ((len = read(E.watch_fd, buf, sizeof(buf))) > 0){
+		for (char *p = buf; p < buf + len; ){
+			struct inotify_event *ev = (struct inotify_event *)p;
+			if (base && ev->wd == E.watch_wd && ev->len && !strcmp(ev->name, base)) ours = 1;
+			p += sizeof(struct inotify_event) + ev->len;
+		}
+	}
+	if (!ours) return 0;
+	if (E.follow_fd != -1) return editorFollowRead();
+	editorReloadFile();
+	return 1;
+}
+
+/*** FOLLOW ***/
+
+//Start following from wherever the buffer's copy of the file ends
+void editorFollowOpen(){
+	E.follow_fd = open(E.filename, O_RDONLY | O_CLOEXEC);
+	if (E.follow_fd == -1) return;
+	struct stat st;
+	fstat(E.follow_fd, &st);
+	E.file_stat = st;
+	E.follow_off = st.st_size;
+	//a last line with no newline yet will be carried on by the next write
+	char last = '\n';
+	if (E.follow_off > 0 && pread(E.follow_fd, &last, 1, E.follow_off - 1) != 1) last = '\n';
+	E.follow_partial = (last != '\n' && E.numrows > 0);
+	E.follow_dirty = E.dirty;
+	E.follow_more = 0;
+}
+
+void editorFollowClose(){
+	if (E.follow_fd == -1) return;
+	close(E.follow_fd);
+	E.follow_fd = -1;
+}
+
+void editorToggleFollow(){
+	if (E.follow_fd != -1){
+		editorFollowClose();
+		editorWatchFile();
+		editorSetStatusMessage("Stopped following %s", E.filename);
+		return;
+	}
+	if (E.filename == NULL){
+		editorSetStatusMessage("No file to follow");
+		return;
+	}
+	if (E.hex){
+		editorSetStatusMessage("Can't follow the hex view");
+		return;
+	}
+	//bytes appended to the file aren't more text, they're more compressed data
+	if (E.compress){
+		editorSetStatusMessage("Can't follow a %s compressed file", E.compress->name);
+		return;
+	}
+	//anything written since the buffer was loaded is a change, not an append
+	editorReloadFile();
+	editorFollowOpen();
+	if (E.follow_fd == -1){
+		editorSetStatusMessage("Can't follow %s: %s", E.filename, strerror(errno));
+		return;
+	}
+	editorWatchFile();
+	if (E.numrows > 0) E.cy = E.numrows - 1;
+	E.cx = E.ln_length;
+	editorSetStatusMessage("Following %s, :follow again to stop", E.filename);
+}
+
+//Is there a key waiting? Reading appends gives way to keys
+int editorKeyPending(){
+	struct pollfd pfd = { E.infd, POLLIN, 0 };
+	return poll(&pfd, 1, 0) > 0;
+}
+
+//Add what's been appended to the followed file as rows at the end of the
+//buffer. It's read a chunk at a time and stops after KILO_FOLLOW_SLICE_NS or
+//as soon as a key comes in, leaving follow_more set for the rest. The view only
+//moves along with the new rows if the cursor was on the last one. Returns 1 if
+//the buffer changed
+int editorFollowRead(){
+	struct stat st, named;
+	if (fstat(E.follow_fd, &st) == -1) return 0;
+	//a rotated log shows up as a new file under the name, start over with it
+	int replaced = stat(E.filename, &named) == 0 &&
+		(named.st_ino != st.st_ino || named.st_dev != st.st_dev);
+	if (replaced || st.st_size < E.follow_off){
+		editorFollowClose();
+		//the new file can't be read in over unsaved changes, and carrying on
+		//from its end would skip what's in it
+		if (E.dirty){
+			editorWatchFile();
+			editorSetStatusMessage("%s was replaced, stopped following to keep unsaved changes", E.filename);
+			return 1;
+		}
+		editorReloadFile();
+		editorFollowOpen();
+		return 1;
+	}
+	if (st.st_size == E.follow_off){
+		E.follow_more = 0;
+		return 0;
+	}
+
+	unsigned long long start = nowNanos();
+	int bottom = E.cy >= E.numrows - 1;
+	int at = E.numrows;
+	int old = 0;
+	struct newRows nr = {0};
+	//the old last line gets finished off by the new bytes, unless it's been
+	//edited (or deleted) since, then they start a line of their own
+	if (E.dirty != E.follow_dirty || E.numrows == 0) E.follow_partial = 0;
+	if (E.follow_partial){
+		at = E.numrows - 1;
+		old = 1;
+		newRowsAddPartial(&nr, E.row[at].chars, E.row[at].size);
+	}
+	char *buf = memAlloc(KILO_FILTER_CHUNK);
+	while (E.follow_off < st.st_size){
+		long want = st.st_size - E.follow_off;
+		if (want > KILO_FILTER_CHUNK) want = KILO_FILTER_CHUNK;
+		ssize_t n = pread(E.follow_fd, buf, want, E.follow_off);
+		if (n <= 0) break;
+		newRowsTakeLines(&nr, buf, n);
+		E.follow_off += n;
+		if (nowNanos() - start > KILO_FOLLOW_SLICE_NS || editorKeyPending()) break;
+	}
+	memFree(buf);
+	E.follow_partial = nr.plen > 0;
+	E.follow_dirty = E.dirty;
+	newRowsFinish(&nr);
+	editorSpliceRows(at, old, &nr);
+	E.follow_more = E.follow_off < st.st_size;
+	E.file_stat = st;
+	if (bottom && E.numrows > 0){
+		E.cy = E.numrows - 1;
+		if (E.cx - E.ln_length > E.row[E.cy].size) E.cx = E.row[E.cy].size + E.ln_length;
+	}
+	return 1;
+}
+
+/*** HEX ***/
+
+//Binary files are shown 16 bytes to a row as hex and ASCII, straight out of a
+//read only private mapping of the file. Nothing is read until it's drawn and
+//only the rows on screen are formatted, so a file of any size costs the same.
+//Typing hex digits makes just the page they're on writable, which copies it,
+//and saving writes those pages back with pwrite and maps the file over them
+//again. In the hex view E.cy and E.rowoff count rows of bytes and E.cx is the
+//nibble in the row
+
+//Does the start of the file have a NUL in it?
+int editorFileIsBinary(char *filename){
+	int fd = open(filename, O_RDONLY);
+	if (fd == -1) return 0;
+	char buf[KILO_HEX_SNIFF];
+	ssize_t n = read(fd, buf, sizeof(buf));
+	close(fd);
+	//those are text once they're decompressed
+	if (n > 0 && editorCompression(buf, n)) return 0;
+	return n > 0 && memchr(buf, '\0', n) != NULL;
+}
+
+//Show filename in the current buffer, which has to be empty, as hex.
+//Returns -1 with errno set if it can't be mapped
+int editorHexOpen(char *filename){
+	int writable = 1;
+	int fd = open(filename, O_RDWR | O_CLOEXEC);
+	if (fd == -1 && (errno == EACCES || errno == EROFS)){
+		writable = 0;
+		fd = open(filename, O_RDONLY | O_CLOEXEC);
+	}
+	if (fd == -1) return -1;
+	struct stat st;
+	if (fstat(fd, &st) == -1){
+		close(fd);
+		return -1;
+	}
+	//rows are counted in an int
+	if (!S_ISREG(st.st_mode) || st.st_size / KILO_HEX_COLS > INT_MAX){
+		close(fd);
+		errno = S_ISREG(st.st_mode) ? EFBIG : EINVAL;
+		return -1;
+	}
+	unsigned char *map = NULL;
+	if (st.st_size > 0){
+		map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (map == MAP_FAILED){
+			int err = errno;
+			close(fd);
+			errno = err;
+			return -1;
+		}
+	}
+	struct editorHex *h = memCalloc(1, sizeof(struct editorHex));
+	h->fd = fd;
+	h->map = map;
+	h->size = h->maplen = st.st_size;
+	h->writable = writable;
+	h->pagesize = sysconf(_SC_PAGESIZE);
+	h->digits = 8;
+	while (h->digits < 16 && (st.st_size - 1) >> (4 * h->digits) > 0) h->digits++;
+	E.hex = h;
+	E.syntax = NULL;
+	E.file_stat = st;
+	E.dirty = 0;
+	E.cy = E.rowoff = E.coloff = 0;
+	E.cx = E.ln_length;
+	return 0;
+}
+
+void editorHexFree(struct editorHex *h){
+	if (h->map) munmap(h->map, h->maplen);
+	close(h->fd);
+	memFree(h->pages);
+	memFree(h);
+}
+
+long editorHexRows(struct editorHex *h){
+	return (h->size + KILO_HEX_COLS - 1) / KILO_HEX_COLS;
+}
+
+//Screen column of nibble nib of a row, past the offset
+int editorHexColumn(struct editorHex *h, int nib){
+	int i = nib / 2;
+	return h->digits + 2 + i * 3 + (i >= KILO_HEX_COLS / 2) + nib % 2;
+}
+
+//Put the cursor on byte off, on its high nibble
+void editorHexGoto(long off){
+	struct editorHex *h = E.hex;
+	if (off >= h->size) off = h->size - 1;
+	if (off < 0) off = 0;
+	E.cy = off / KILO_HEX_COLS;
+	E.cx = E.ln_length + (off % KILO_HEX_COLS) * 2;
+}
+
+//The file changed size under the hex view. Pages past the end of the file
+//fault when they're read, so without unsaved changes it's mapped again at its
+//new size. With them the view only shrinks to what's left, along with the
+//changes, and a file that grew is mapped again once they're saved
+void editorHexReload(){
+	struct editorHex *h = E.hex;
+	struct stat st;
+	if (fstat(h->fd, &st) == -1 || st.st_size == h->size) return;
+	long off = (long)E.cy * KILO_HEX_COLS + (E.cx - E.ln_length) / 2;
+	if (h->npages == 0){
+		unsigned char *map = NULL;
+		if (st.st_size > 0 && st.st_size / KILO_HEX_COLS <= INT_MAX){
+			map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, h->fd, 0);
+			if (map == MAP_FAILED) map = NULL;
+		}
+		if (h->map) munmap(h->map, h->maplen);
+		h->map = map;
+		h->size = h->maplen = map ? st.st_size : 0;
+		while (h->digits < 16 && (h->size - 1) >> (4 * h->digits) > 0) h->digits++;
+		E.file_stat = st;
+		if (map == NULL && st.st_size > 0)
+			editorSetStatusMessage("%s changed on disk, can't map it again: %s", E.filename, strerror(errno));
+	}
+	else if (st.st_size < h->size){
+		h->size = st.st_size;
+		int kept = 0;
+		for (int i = 0; i < h->npages; i++)
+			if (h->pages[i] * h->pagesize < h->size) h->pages[kept++] = h->pages[i];
+		h->npages = kept;
+		editorSetStatusMessage("%s shrank on disk, changes past its end are gone", E.filename);
+	}
+	else{
+		return;
+	}
+	editorHexGoto(off);
+	if (E.rowoff > E.cy) E.rowoff = E.cy;
+}
+
+//The hex view's editorScroll: keep the cursor's row on screen and work out
+//the column it's drawn at
+void editorHexScroll(){
+	//a file truncated before its watch event comes in still mustn't be drawn
+	editorHexReload();
+	struct editorHex *h = E.hex;
+	int nib = E.cx - E.ln_length;
+	long off = (long)E.cy * KILO_HEX_COLS + nib / 2;
+	if (off >= h->size){
+		editorHexGoto(h->size - 1);
+		nib = E.cx - E.ln_length;
+	}
+	if (E.cy < E.rowoff) E.rowoff = E.cy;
+	if (E.cy >= E.rowoff + E.screenrows) E.rowoff = E.cy - E.screenrows + 1;
+	E.coloff = 0;
+	E.rx = editorHexColumn(h, nib);
+}
+
+//Make the page off is on writable and keep track of it, the pages that
+//differ from the file are kept in order. Returns -1 if it can't be written
+int editorHexTouch(long off){
+	struct editorHex *h = E.hex;
+	long page = off / h->pagesize;
+	int lo = 0, hi = h->npages;
+	while (lo < hi){
+		int mid = (lo + hi) / 2;
+		if (h->pages[mid] < page) lo = mid + 1;
+		else hi = mid;
+	}
+	if (lo < h->npages && h->pages[lo] == page) return 0;
+	if (mprotect(h->map + page * h->pagesize, h->pagesize, PROT_READ | PROT_WRITE) == -1) return -1;
+	if (h->npages == h->cap){
+		h->cap = h->cap ? h->cap * 2 : 16;
+		h->pages = memRealloc(h->pages, sizeof(long) * h->cap);
+	}
+	memmove(&h->pages[lo + 1], &h->pages[lo], sizeof(long) * (h->npages - lo));
+	h->pages[lo] = page;
+	h->npages++;
+	return 0;
+}
+
+//Set the nibble under the cursor to v and move on to the next one
+void editorHexSetNibble(int v){
+	struct editorHex *h = E.hex;
+	int nib = E.cx - E.ln_length;
+	long off = (long)E.cy * KILO_HEX_COLS + nib / 2;
+	if (off >= h->size) return;
+	if (editorHexTouch(off) == -1){
+		editorSetStatusMessage("Can't change the byte: %s", strerror(errno));
+		return;
+	}
+	unsigned char *p = &h->map[off];
+	if (nib % 2) *p = (*p & 0xf0) | v;
+	else *p = (*p & 0x0f) | (v << 4);
+	editorDamage(E.cy);
+	E.dirty++;
+	if (nib % 2) editorHexGoto(off + 1);
+	else E.cx++;
+}
+
+//Keys in the hex view. Returns 0 for the ones that do the same thing as they
+//do in text
+int editorHexKey(int c, int count){
+	struct editorHex *h = E.hex;
+	int nib = E.cx - E.ln_length;
+	long off = (long)E.cy * KILO_HEX_COLS + nib / 2;
+	switch (c){
+		case CTRL_KEY('e'):
+		case CTRL_KEY('q'):
+		case CTRL_KEY('s'):
+		case CTRL_KEY('y'):
+		case CTRL_KEY('t'):
+		case CTRL_KEY('p'):
+		case CTRL_KEY('w'):
+		case CTRL_KEY('r'):
+		case CTRL_KEY('a'):
+			return 0;
+		case ARROW_LEFT:
+		case BACKSPACE:
+		case CTRL_KEY('h'):
+			editorHexGoto(off - count);
+			break;
+		case ARROW_RIGHT:
+			editorHexGoto(off + count);
+			break;
+		case ARROW_UP:
+			editorHexGoto(off - (long)KILO_HEX_COLS * count);
+			break;
+		case ARROW_DOWN:
+			if (off + (long)KILO_HEX_COLS * count < h->size) editorHexGoto(off + (long)KILO_HEX_COLS * count);
+			break;
+		case PAGE_UP:
+		case PAGE_DOWN: {
+			long rows = (long)E.screenrows * count * (c == PAGE_UP ? -1 : 1);
+			long top = E.rowoff + rows;
+			if (top > editorHexRows(h) - 1) top = editorHexRows(h) - 1;
+			if (top < 0) top = 0;
+			E.rowoff = top;
+			editorHexGoto(off + rows * KILO_HEX_COLS);
+			break;
+		}
+		case HOME_KEY:
+			editorHexGoto(off - off % KILO_HEX_COLS);
+			break;
+		case END_KEY:
+			editorHexGoto(off - off % KILO_HEX_COLS + KILO_HEX_COLS - 1);
+			break;
+		case '\x1b':
+		case CTRL_KEY('l'):
+			break;
+		default:
+			if (c < 128 && isxdigit(c)){
+				if (!h->writable) editorSetStatusMessage("%s is read only", E.filename);
+				else editorHexSetNibble(isdigit(c) ? c - '0' : tolower(c) - 'a' + 10);
+			}
+			else{
+				editorSetStatusMessage("Type hex digits to change bytes, Ctrl-E then an offset to go to it");
+			}
+			break;
+	}
+	return 1;
+}
+
+//Write the pages that were changed back where they came from. Once they're
+//in the file their copies aren't needed, it's mapped over them again
+void editorHexSave(){
+	struct editorHex *h = E.hex;
+	long bytes = 0;
+	int pages = h->npages;
+	//pages that couldn't be mapped over again keep their copies, which are
+	//the same as the file now, and stay on the list as they take up memory
+	int kept = 0;
+	for (int i = 0; i < h->npages; i++){
+		long off = h->pages[i] * h->pagesize;
+		long len = h->size - off < h->pagesize ? h->size - off : h->pagesize;
+		if (pwrite(h->fd, h->map + off, len, off) != len){
+			//the ones already written don't need writing again
+			memmove(&h->pages[kept], &h->pages[i], sizeof(long) * (h->npages - i));
+			h->npages = kept + h->npages - i;
+			editorSetStatusMessage("Can't save! I/0 error: %s", strerror(errno));
+			return;
+		}
+		if (mmap(h->map + off, len, PROT_READ, MAP_PRIVATE | MAP_FIXED, h->fd, off) == MAP_FAILED)
+			h->pages[kept++] = h->pages[i];
+		bytes += len;
+	}
+	h->npages = kept;
+	E.dirty = 0;
+	fstat(h->fd, &E.file_stat);
+	editorSetStatusMessage("%ld bytes written to disk (%d page%s)", bytes, pages, pages == 1 ? "" : "s");
+}
+
+//Commands that mean something else in the hex view: a number (0x for hex)
+//or a percentage is an offset to go to. Returns 0 if p isn't one of them
+int editorHexCommand(char *p){
+	if (*p == '!'){
+		editorSetStatusMessage("Can't filter the hex view");
+		return 1;
+	}
+	char *end;
+	int base = (p[0] == '0' && (p[1] == 'x' || p[1] == 'X')) ? 16 : 10;
+	long off = strtol(p, &end, base);
+	if (end == p || (!isdigit((unsigned char)*p) && base == 10)) return 0;
+	if (*end == '%'){
+		end++;
+		off = E.hex->size / 100 * off + E.hex->size % 100 * off / 100;
+	}
+	while (isspace((unsigned char)*end)) end++;
+	if (*end != '\0') return 0;
+	editorHexGoto(off);
+	E.rowoff = E.cy - E.screenrows / 2;
+	if (E.rowoff < 0) E.rowoff = 0;
+	return 1;
+}
+
+/*** BUFFERS ***/
+
+//E holds the current buffer, the others wait in their slots in E.bufs. Going
+//to another buffer moves the fields that belong to the file out of E and the
+//other buffer's in, so nothing else has to know there's more than one. Put
+//aside buffers don't keep render or highlighting, and unmodified ones that
+//go past the memory budget let go of their rows too and are read back from
+//their file when they're next used
+
+//Roughly what the current buffer's rows take up: the text plus a row and a
+//text header for each line
+long editorBufferBytes(){
+	//what's unchanged of a mapped file can be dropped and read again any time
+	if (E.hex) return (long)E.hex->npages * E.hex->pagesize;
+	return editorFileSize() + (long)E.numrows * (sizeof(erow) + sizeof(struct rowtext));
+}
+
+//Read filename into the current buffer, which has to be empty, through a
+//mapping of it like editorReloadFile (or its open cache), or through its
+//decompressor if it's compressed. A file that only looks compressed, or has
+//no decompressor here, goes in the hex view instead and 1 is returned, with a
+//status message saying so. Returns -1 with errno set if it can't be read at all
+int editorLoadFile(char *filename){
+	int fd = open(filename, O_RDONLY);
+	if (fd == -1) return -1;
+	struct stat st;
+	if (fstat(fd, &st) == -1){
+		close(fd);
+		return -1;
+	}
+	struct newRows nr = {0};
+	char *data = NULL;
+	int cached = 0;
+	E.compress = editorFileCompression(fd);
+	if (E.compress && editorDecompress(fd, E.compress, &nr) == -1){
+		//as rows, saving would rewrite every line ending of it, the hex view
+		//only ever writes back the bytes that were typed over
+		char *name = E.compress->name;
+		E.compress = NULL;
+		close(fd);
+		if (editorHexOpen(filename) == -1) return -1;
+		editorSetStatusMessage("Can't decompress %s with %s, showing it as hex", filename, name);
+		return 1;
+	}
+	if (E.compress){
+		close(fd);
+	}
+	else{
+		if (st.st_size > 0){
+			data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+			if (data == MAP_FAILED){
+				int err = errno;
+				close(fd);
+				errno = err;
+				return -1;
+			}
+		}
+		close(fd);
+		cached = editorCacheLoad(filename, &st, data);
+		for (long off = 0; !cached && off < st.st_size; off += KILO_FILTER_CHUNK){
+			long len = st.st_size - off;
+			newRowsTakeLines(&nr, data + off, len > KILO_FILTER_CHUNK ? KILO_FILTER_CHUNK : len);
+		}
+		newRowsFinish(&nr);
+	}
+	if (!cached){
+		editorSpliceRows(0, 0, &nr);
+		if (data) editorCacheSave(filename, &st, data);
+	}
+	if (data) munmap(data, st.st_size);
+	E.file_stat = st;
+	E.dirty = 0;
+	editorBlockOffsets();
+	return 0;
+}
+
+//Copy the fields of E that belong to the file into slot b
+void editorBufferStash(struct editorBuffer *b){
+	b->filename = E.filename;
+	b->row = E.row;
+	b->numrows = E.numrows;
+	b->dirty = E.dirty;
+	b->cx = E.cx - E.ln_length;
+	b->cy = E.cy;
+	b->rowoff = E.rowoff;
+	b->coloff = E.coloff;
+	b->syntax = E.syntax;
+	b->mark_set = E.mark_set;
+	b->mark_cx = E.mark_cx - E.ln_length;
+	b->mark_cy = E.mark_cy;
+	b->stale_rows = E.stale_rows;
+	b->stale_from = E.stale_from;
+	b->blocks = E.blocks;
+	b->nblocks = E.nblocks;
+	b->cold_blocks = E.cold_blocks;
+	b->offsets_from = E.offsets_from;
+	b->br_tree = E.br_tree;
+	b->br_size = E.br_size;
+	b->br_stale = E.br_stale;
+	b->br_dirty = E.br_dirty;
+	b->br_ndirty = E.br_ndirty;
+	b->br_cap = E.br_cap;
+	b->br_hint = E.br_hint;
+	b->lru_hand = E.lru_hand;
+	b->file_stat = E.file_stat;
+	b->hex = E.hex;
+	b->compress = E.compress;
+}
+
+//and back from slot b into E
+void editorBufferLoad(struct editorBuffer *b){
+	E.filename = b->filename;
+	E.row = b->row;
+	E.numrows = b->numrows;
+	E.dirty = b->dirty;
+	E.cy = b->cy;
+	E.rowoff = b->rowoff;
+	E.coloff = b->coloff;
+	E.syntax = b->syntax;
+	E.mark_set = b->mark_set;
+	E.mark_cy = b->mark_cy;
+	E.stale_rows = b->stale_rows;
+	E.stale_from = b->stale_from;
+	E.blocks = b->blocks;
+	E.nblocks = b->nblocks;
+	E.cold_blocks = b->cold_blocks;
+	E.offsets_from = b->offsets_from;
+	E.br_tree = b->br_tree;
+	E.br_size = b->br_size;
+	E.br_stale = b->br_stale;
+	E.br_dirty = b->br_dirty;
+	E.br_ndirty = b->br_ndirty;
+	E.br_cap = b->br_cap;
+	E.br_hint = b->br_hint;
+	E.lru_hand = b->lru_hand;
+	E.file_stat = b->file_stat;
+	E.hex = b->hex;
+	E.compress = b->compress;
+	configureLNLength();
+	E.cx = b->cx + E.ln_length;
+	E.mark_cx = b->mark_cx + E.ln_length;
+}
+
+//Move the current buffer out of E into its slot
+void editorBufferPutAside(){
+	struct editorBuffer *b = &E.bufs[E.cur_buf];
+	//only the current buffer is watched, so it can't be followed either
+	editorFollowClose();
+	//the rows on screen are quick to do again when it comes back
+	for (int j = 0; j < E.numrows; j++)
+		if (E.row[j].flags & ROW_DERIVED) editorRowDropDerived(&E.row[j]);
+	editorBufferStash(b);
+	b->bytes = editorBufferBytes();
+	b->cold = 0;
+	b->used = ++E.buf_clock;
+}
+
+//Make buffer i the current one, reading it again if it was let go
+void editorBufferBringBack(int i){
+	struct editorBuffer *b = &E.bufs[i];
+	E.cur_buf = i;
+	if (E.win) E.win->buf = i;
+	editorBufferLoad(b);
+	E.match_cy = -1;
+	int col = E.cx - E.ln_length;
+	if (b->cold){
+		b->cold = 0;
+		E.buf_reloads++;
+		if (editorLoadFile(E.filename) == -1)
+			editorSetStatusMessage("Can't read %s again: %s", E.filename, strerror(errno));
+	}
+	//it wasn't watched while it was put aside
+	else if (E.filename){
+		editorReloadFile();
+	}
+	if (E.hex){
+		editorWatchFile();
+		return;
+	}
+	configureLNLength();
+	E.cx = col + E.ln_length;
+	//the file can be shorter than it was if it had to be read again
+	if (E.cy > E.numrows) E.cy = E.numrows;
+	if (E.cy < E.numrows && E.cx - E.ln_length > E.row[E.cy].size)
+		E.cx = E.row[E.cy].size + E.ln_length;
+	int r0, c0, r1, c1;
+	if (E.mark_set && !editorSelection(&r0, &c0, &r1, &c1)) E.mark_set = 0;
+	editorWatchFile();
+	//rows a macro left unhighlighted before going to another buffer
+	if (E.stale_rows && !E.macro_playing) editorHighlightStale();
+}
+
+//Let go of a put aside buffer's rows, it can be read from its file again
+void editorBufferRelease(struct editorBuffer *b){
+	for (int j = 0; j < b->numrows; j++){
+		editorWordsRemoveRow(&b->row[j]);
+		editorRowDropDerived(&b->row[j]);
+		rowTextRelease(b->row[j].chars);
+	}
+	for (int i = 0; i < b->nblocks; i++) editorBlockDropSymbols(&b->blocks[i]);
+	if (b->hex) editorHexFree(b->hex);
+	b->hex = NULL;
+	memFree(b->row);
+	memFree(b->blocks);
+	memFree(b->br_tree);
+	memFree(b->br_dirty);
+	b->row = NULL;
+	b->numrows = 0;
+	b->stale_rows = 0;
+	b->stale_from = 0;
+	b->blocks = NULL;
+	b->nblocks = 0;
+	b->cold_blocks = 0;
+	b->offsets_from = 0;
+	b->br_tree = NULL;
+	b->br_size = 0;
+	b->br_stale = 1;
+	b->br_dirty = NULL;
+	b->br_ndirty = 0;
+	b->br_cap = 0;
+	b->br_hint = 0;
+	b->lru_hand = 0;
+	b->bytes = 0;
+	b->cold = 1;
+}
+
+//Get all the open buffers' text back under the memory budget by letting go
+//of the unmodified ones that were used longest ago. Modified ones would lose
+//their changes, so with enough of them it stays over
+void editorBuffersTrim(){
+	long total = editorBufferBytes();
+	for (int i = 0; i < E.nbufs; i++)
+		if (i != E.cur_buf) total += E.bufs[i].bytes;
+	while (total > E.memory_budget){
+		int lru = -1;
+		for (int i = 0; i < E.nbufs; i++){
+			struct editorBuffer *b = &E.bufs[i];
+			if (i == E.cur_buf || b->cold || b->dirty || b->filename == NULL || b->hex) continue;
+			//it'd only have to be read straight back to draw it
+			if (editorBufferShown(i)) continue;
+			if (lru == -1 || b->used < E.bufs[lru].used) lru = i;
+		}
+		if (lru == -1) break;
+		total -= E.bufs[lru].bytes;
+		editorBufferRelease(&E.bufs[lru]);
+	}
+}
+
+void editorBufferSwitch(int i){
+	if (i == E.cur_buf) return;
+	editorBufferPutAside();
+	E.alt_buf = E.cur_buf;
+	editorBufferBringBack(i);
+	editorBuffersTrim();
+}
+
+//Add an empty slot and make it the current buffer
+void editorBufferAdd(){
+	editorBufferPutAside();
+	E.bufs = memRealloc(E.bufs, sizeof(struct editorBuffer) * (E.nbufs + 1));
+	struct editorBuffer *b = &E.bufs[E.nbufs];
+	memset(b, 0, sizeof(*b));
+	b->br_stale = 1;
+	E.alt_buf = E.cur_buf;
+	editorBufferBringBack(E.nbufs++);
+}
+
+//The buffer filename is open in, if any. Names that are the same file (a
+//different path, a link) count too
+int editorBufferFind(char *filename){
+	struct stat st;
+	int exists = stat(filename, &st) == 0;
+	for (int i = 0; i < E.nbufs; i++){
+		char *name = i == E.cur_buf ? E.filename : E.bufs[i].filename;
+		struct stat *fst = i == E.cur_buf ? &E.file_stat : &E.bufs[i].file_stat;
+		if (name == NULL) continue;
+		if (!strcmp(name, filename)) return i;
+		if (exists && fst->st_ino == st.st_ino && fst->st_dev == st.st_dev) return i;
+	}
+	return -1;
+}
+
+//Go to the buffer filename is open in, or open it in a new one. A file
+//that doesn't exist yet gets an empty buffer that saving will create it from.
+//Binary files, or any file with hex set, open in the hex view
+void editorBufferOpen(char *filename, int hex){
+	int i = editorBufferFind(filename);
+	if (i != -1 && (!hex || (i == E.cur_buf ? E.hex : E.bufs[i].hex))){
+		editorBufferSwitch(i);
+		return;
+	}
+	//the empty buffer the editor starts with is used rather than kept
+	if (E.filename || E.numrows > 0 || E.dirty || E.hex) editorBufferAdd();
+	E.filename = memStrdup(filename);
+	unsigned long long start = nowNanos();
+	if (hex || editorFileIsBinary(filename)){
+		if (editorHexOpen(filename) == 0)
+			editorSetStatusMessage("\"%s\" %ld bytes [hex]", filename, E.hex->size);
+		else
+			editorSetStatusMessage("Can't open %s: %s", filename, strerror(errno));
+		latencyRecord(&E.op_latency[OP_OPEN], nowNanos() - start);
+		editorWatchFile();
+		editorBuffersTrim();
+		return;
+	}
+	editorSelectSyntaxHighlight();
+	//1 has already said how it went
+	int loaded = editorLoadFile(filename);
+	if (loaded == 0)
+		editorSetStatusMessage("\"%s\" %d lines", filename, E.numrows);
+	else if (loaded == -1 && errno == ENOENT)
+		editorSetStatusMessage("\"%s\" [New file]", filename);
+	else if (loaded == -1)
+		editorSetStatusMessage("Can't open %s: %s", filename, strerror(errno));
+	latencyRecord(&E.op_latency[OP_OPEN], nowNanos() - start);
+	if (!E.hex){
+		configureLNLength();
+		E.cx = E.ln_length;
+	}
+	editorWatchFile();
+	editorBuffersTrim();
+}
+
+//Close the current buffer and go to the one before it
+void editorBufferClose(int force){
+	if (E.dirty && !force){
+		editorSetStatusMessage("%s has unsaved changes, :bd! closes it anyway",
+			E.filename ? E.filename : "[No Name]");
+		return;
+	}
+	editorBufferPutAside();
+	int gone = E.cur_buf;
+	struct editorBuffer *b = &E.bufs[gone];
+	editorBufferRelease(b);
+	memFree(b->filename);
+	memmove(b, b + 1, sizeof(struct editorBuffer) * (E.nbufs - gone - 1));
+	E.nbufs--;
+	int next = E.alt_buf != -1 ? E.alt_buf : gone;
+	if (next > gone) next--;
+	if (E.nbufs == 0){
+		//there's always a buffer, even if it's an empty one
+		memset(&E.bufs[0], 0, sizeof(struct editorBuffer));
+		E.bufs[0].br_stale = 1;
+		E.nbufs = 1;
+	}
+	if (next >= E.nbufs) next = E.nbufs - 1;
+	//other windows on it go to the same buffer as this one
+	for (struct editorWindow *w = editorWindowFirst(E.win_root); w; w = editorWindowAfter(w)){
+		if (w->buf == gone){
+			w->buf = next;
+			w->cx = w->cy = w->rowoff = w->coloff = 0;
+		}
+		else if (w->buf > gone){
+			w->buf--;
+		}
+	}
+	editorWindowsInvalidate();
+	E.alt_buf = -1;
+	editorBufferBringBack(next);
+}
+
+//The buffer a :b argument means: its number, or a name only one buffer's
+//file name has in it. Returns -1 and says why if there isn't exactly one
+int editorBufferLookup(char *arg){
+	char *end;
+	long n = strtol(arg, &end, 10);
+	if (end != arg && *end == '\0'){
+		if (n < 1 || n > E.nbufs){
+			editorSetStatusMessage("No buffer %ld", n);
+			return -1;
+		}
+		return n - 1;
+	}
+	int found = -1;
+	for (int i = 0; i < E.nbufs; i++){
+		char *name = i == E.cur_buf ? E.filename : E.bufs[i].filename;
+		if (name == NULL || !strstr(name, arg)) continue;
+		if (!strcmp(name, arg)) return i;
+		if (found != -1){
+			editorSetStatusMessage("More than one buffer matches %s", arg);
+			return -1;
+		}
+		found = i;
+	}
+	if (found == -1) editorSetStatusMessage("No buffer matches %s", arg);
+	return found;
+}
+
+//List the buffers in the status bar: % marks the current one, + modified
+//ones and ~ ones that were let go and have to be read again
+void editorBufferList(){
+	char list[sizeof(E.statusmsg)];
+	int len = 0;
+	for (int i = 0; i < E.nbufs && len < (int)sizeof(list); i++){
+		int cur = i == E.cur_buf;
+		char *name = cur ? E.filename : E.bufs[i].filename;
+		char *slash = name ? strrchr(name, '/') : NULL;
+		len += snprintf(list + len, sizeof(list) - len, "%s%d%s%s:%s", i ? "  " : "", i + 1,
+			cur ? "%" : "", (cur ? E.dirty : E.bufs[i].dirty) ? "+" : !cur && E.bufs[i].cold ? "~" : "",
+			slash ? slash + 1 : name ? name : "[No Name]");
+	}
+	editorSetStatusMessage("%s", list);
+}
+
+//How many buffers have changes that haven't been saved
+int editorBuffersDirty(){
+	int n = E.dirty ? 1 : 0;
+	for (int i = 0; i < E.nbufs; i++)
+		if (i != E.cur_buf && E.bufs[i].dirty) n++;
+	return n;
+}
+
+/*** WINDOWS ***/
+
+//The screen is split between windows, each showing part of a buffer with a
+//cursor and offsets of its own. Windows on the same buffer share its rows and
+//their render and highlighting. The current window's view is E's cursor and
+//offsets, the same as with only one window, and the others keep theirs here.
+//A frame draws the current window and any other whose rows on screen changed
+
+void editorDamage(int at){
+	if (at < E.damage_from) E.damage_from = at;
+}
+
+struct editorWindow *editorWindowFirst(struct editorWindow *w){
+	while (w->split != WIN_LEAF) w = w->kids[0];
+	return w;
+}
+
+//The window after w going left to right and top to bottom, or NULL
+struct editorWindow *editorWindowAfter(struct editorWindow *w){
+	while (w->parent && w->parent->kids[1] == w) w = w->parent;
+	if (!w->parent) return NULL;
+	return editorWindowFirst(w->parent->kids[1]);
+}
+
+//Is row at of the current buffer on screen in any window?
+int editorRowShown(int at){
+	if (at >= E.rowoff && at < E.rowoff + E.screenrows) return 1;
+	if (E.nwins <= 1) return 0;
+	for (struct editorWindow *w = editorWindowFirst(E.win_root); w; w = editorWindowAfter(w))
+		if (w != E.win && w->buf == E.cur_buf && at >= w->rowoff && at < w->rowoff + w->rows) return 1;
+	return 0;
+}
+
+//Is buffer i in any window?
+int editorBufferShown(int i){
+	if (E.win_root == NULL) return 0;
+	for (struct editorWindow *w = editorWindowFirst(E.win_root); w; w = editorWindowAfter(w))
+		if (w->buf == i) return 1;
+	return 0;
+}
+
+//Split rows x cols at (top, left) between w and everything under it. With
+//more than one window each one gets a status line, and side by side ones
+//have a column between them
+void editorWindowLayout(struct editorWindow *w, int top, int left, int rows, int cols){
+	w->top = top;
+	w->left = left;
+	w->drawn_ln = 0;
+	if (w->split == WIN_LEAF){
+		w->rows = E.nwins > 1 ? rows - 1 : rows;
+		w->cols = cols;
+		return;
+	}
+	w->rows = rows;
+	w->cols = cols;
+	if (w->split == WIN_ROWS){
+		editorWindowLayout(w->kids[0], top, left, rows / 2, cols);
+		editorWindowLayout(w->kids[1], top + rows / 2, left, rows - rows / 2, cols);
+	}
+	else{
+		int half = (cols - 1) / 2;
+		editorWindowLayout(w->kids[0], top, left, rows, half);
+		editorWindowLayout(w->kids[1], top, left + half + 1, rows, cols - half - 1);
+	}
+}
+
+//Lay every window out again and take the current one's size
+void editorWindowsResize(){
+	editorWindowLayout(E.win_root, 0, 0, E.termrows, E.termcols);
+	if (E.win == NULL) return;
+	E.screenrows = E.win->rows;
+	E.screencols = E.win->cols;
+}
+
+//Everything gets drawn again on the next frame
+void editorWindowsInvalidate(){
+	for (struct editorWindow *w = editorWindowFirst(E.win_root); w; w = editorWindowAfter(w))
+		w->drawn_ln = 0;
+}
+
+//Keep the current window's view in w before another window becomes current
+void editorWindowStash(struct editorWindow *w){
+	w->cx = E.cx - E.ln_length;
+	w->cy = E.cy;
+	w->rowoff = E.rowoff;
+	w->coloff = E.coloff;
+}
+
+//Make w the current window, bringing its buffer in if it's another one
+void editorWindowFocus(struct editorWindow *w){
+	//whatever was drawn for the cursor goes from the old one
+	if (E.win) E.win->drawn_ln = 0;
+	E.win = w;
+	w->drawn_ln = 0;
+	if (w->buf != E.cur_buf) editorBufferSwitch(w->buf);
+	//edits through another window can have left it past the end
+	E.cy = w->cy < E.numrows ? w->cy : E.numrows;
+	E.cx = w->cx + E.ln_length;
+	if (E.cy < E.numrows && w->cx > E.row[E.cy].size) E.cx = E.row[E.cy].size + E.ln_length;
+	E.rowoff = w->rowoff;
+	E.coloff = w->coloff;
+	E.screenrows = w->rows;
+	E.screencols = w->cols;
+}
+
+//Split the current window in two, how is WIN_ROWS or WIN_COLS. Both halves
+//start out showing the same thing and the top or left one stays current
+int editorWindowSplit(int how){
+	struct editorWindow *w = E.win;
+	int area = w->rows + (E.nwins > 1);
+	if (how == WIN_ROWS ? area < 4 : w->cols < 2 * (E.ln_length + 8) + 1){
+		editorSetStatusMessage("Not enough room to split");
+		return 0;
+	}
+	editorWindowStash(w);
+	struct editorWindow *a = memAlloc(sizeof(struct editorWindow));
+	struct editorWindow *b = memAlloc(sizeof(struct editorWindow));
+	*a = *w;
+	*b = *w;
+	a->parent = b->parent = w;
+	w->split = how;
+	w->kids[0] = a;
+	w->kids[1] = b;
+	E.win = a;
+	E.nwins++;
+	editorWindowsResize();
+	return 1;
+}
+
+//Close the current window, the window or split it shared its space with
+//gets all of it
+void editorWindowClose(){
+	if (E.nwins == 1){
+		editorSetStatusMessage("Can't close the last window");
+		return;
+	}
+	struct editorWindow *w = E.win;
+	struct editorWindow *p = w->parent;
+	struct editorWindow *other = p->kids[p->kids[0] == w];
+	struct editorWindow *gp = p->parent;
+	*p = *other;
+	p->parent = gp;
+	if (p->split != WIN_LEAF) p->kids[0]->parent = p->kids[1]->parent = p;
+	memFree(other);
+	memFree(w);
+	E.win = NULL;
+	E.nwins--;
+	editorWindowsResize();
+	editorWindowFocus(editorWindowFirst(p));
+}
+
+//Free w and everything under it apart from the current window
+void editorWindowFree(struct editorWindow *w){
+	if (w->split != WIN_LEAF){
+		editorWindowFree(w->kids[0]);
+		editorWindowFree(w->kids[1]);
+	}
+	if (w != E.win) memFree(w);
+}
+
+//Close every window but the current one
+void editorWindowOnly(){
+	if (E.nwins == 1) return;
+	editorWindowFree(E.win_root);
+	E.win_root = E.win;
+	E.win->parent = NULL;
+	E.nwins = 1;
+	editorWindowsResize();
+}
+
+void editorWindowNext(){
+	if (E.nwins == 1){
+		editorSetStatusMessage("Only one window");
+		return;
+	}
+	struct editorWindow *w = editorWindowAfter(E.win);
+	if (w == NULL) w = editorWindowFirst(E.win_root);
+	editorWindowStash(E.win);
+	editorWindowFocus(w);
+}
+
+/*** FIND ***/
+
+void editorFindCallback(char *query, int key){
+	static int last_match = -1;
+	static int direction = 1;
+
+	static int saved_hl_line;
+	static int saved_hlcount;
+	static hlspan *saved_hl = NULL;
+	//If we have a stored highlighted_line, restored that before we do anything else
+	if (saved_hl) {
+		//Can use saved_hl_line as index because file not modifiable in find state. will need to change if
+		//that functionality is modified
+		erow *row = &E.row[saved_hl_line];
+		//if the row got dropped from the cache in the meantime there's nothing to restore
+		if (row->flags & ROW_DERIVED){
+			E.derived_bytes += sizeof(hlspan) * (saved_hlcount - row->hlcount);
+			memFree(row->hl);
+			row->hl = saved_hl;
+			row->hlcount = saved_hlcount;
+		}
+		else{
+			memFree(saved_hl);
+		}
+		saved_hl = NULL;
+	}	
+	//Finish if we press escape and reset everything
+	if (key == '\r' || key == '\x1b'){
+		last_match = -1;
+		direction = 1;
+		return;
+	}
+	//Find next instance
+	else if (key == ARROW_RIGHT || key == ARROW_DOWN){
+		direction = 1;
+	}
+	//Find previous instance
+	else if (key == ARROW_LEFT || key == ARROW_UP){
+		direction = -1;
+	}
+	else{
+		last_match = -1;
+		direction = 1;
+	}
+
+	if (last_match == -1) direction = 1;
+	int current = last_match;
+	//match cursor to next instance of the query string
+	int i;
+	for (i = 0; i < E.numrows; i++){
+		current += direction;
+		if (current == -1) current = E.numrows - 1;
+		else if (current == E.numrows) current = 0;
+		//See if our query is a substring of the current row. Look at the raw
+		//text so rows that aren't cached don't need to be rebuilt just to check
+		erow *row = &E.row[current];
+		char *match = strstr(row->chars, query);
+		if (match){
+			last_match = current;
+			E.cy = current;
+			E.cx = match - row->chars + E.ln_length;
+			E.rowoff = E.numrows;
+			editorRowEnsureDerived(row);
+			int rx = editorRowCxToRx(row, E.cx) - E.ln_length;
+			//Save the non-highlighted text so we can restore the line when we exit the find state
+			saved_hl_line = current;
+			saved_hlcount = row->hlcount;
+			saved_hl = memAlloc(sizeof(hlspan) * row->hlcount);
+			memcpy(saved_hl, row->hl, sizeof(hlspan) * row->hlcount);
+			//Highlight the matching part of the text
+			editorRowSetHighlight(row, rx, strlen(query), HL_MATCH);
+			break;
+		}
+	}
+}
+
+void editorFind(){
+	int saved_cx = E.cx;
+	int saved_cy = E.cy;
+	int saved_coloff = E.coloff;
+	int saved_rowoff = E.rowoff;
+
+	E.key_context = OP_FIND;
+	char *query = editorPrompt("Search: %s (Use ESC/Arrows/Enter)", editorFindCallback);
+	E.key_context = 0;
+	if (query){
+		memFree(query);
+	}
+	else{
+		E.cx = saved_cx;
+		E.cy = saved_cy;
+		E.coloff = saved_coloff;
+		E.rowoff = saved_rowoff;
+	}
+}
+
+/*** COMPLETION ***/
+
+//Identifiers are kept in a compressed trie along with how many times each one
+//occurs. A row adds its words once its text reaches editorUpdateRender, and
+//takes them away again before the text changes (editorRowReserve, and the
+//places that swap a row's text out whole) or the row goes. The trie is built
+//from every row the first time it's needed, after that nothing rescans
+
+static inline int isWordChar(char c){
+	return isalnum((unsigned char)c) || c == '_';
+}
+
+struct trienode *trieNew(const char *label, int len){
+	struct trienode *n = memCalloc(1, sizeof(struct trienode));
+	n->label = memAlloc(len ? len : 1);
+	memcpy(n->label, label, len);
+	n->len = len;
+	E.words.nodes++;
+	E.words.bytes += sizeof(struct trienode) + len;
+	return n;
+}
+
+//n's kids array is resized to nkids, new slots are left for the caller
+void trieSetKids(struct trienode *n, int nkids){
+	E.words.bytes += (long)sizeof(struct trienode *) * (nkids - n->nkids);
+	if (nkids == 0){
+		memFree(n->kids);
+		n->kids = NULL;
+	}
+	else n->kids = memRealloc(n->kids, sizeof(struct trienode *) * nkids);
+	n->nkids = nkids;
+}
+
+void trieFree(struct trienode *n){
+	trieSetKids(n, 0);
+	E.words.nodes--;
+	E.words.bytes -= sizeof(struct trienode) + n->len;
+	memFree(n->label);
+	memFree(n);
+}
+
+//Index of n's kid starting with c, or where it would go. *found says which
+int trieKid(struct trienode *n, char c, int *found){
+	int lo = 0, hi = n->nkids;
+	while (lo < hi){
+		int mid = (lo + hi) / 2;
+		if ((unsigned char)n->kids[mid]->label[0] < (unsigned char)c) lo = mid + 1;
+		else hi = mid;
+	}
+	*found = lo < n->nkids && n->kids[lo]->label[0] == c;
+	return lo;
+}
+
+void trieAdd(struct trienode *n, const char *w, int len){
+	if (len == 0){
+		if (n->count++ == 0) E.words.words++;
+		if (n->count > n->best) n->best = n->count;
+		return;
+	}
+	int found;
+	int i = trieKid(n, w[0], &found);
+	if (!found){
+		struct trienode *k = trieNew(w, len);
+		trieSetKids(n, n->nkids + 1);
+		memmove(&n->kids[i + 1], &n->kids[i], sizeof(struct trienode *) * (n->nkids - 1 - i));
+		n->kids[i] = k;
+		trieAdd(k, w + len, 0);
+	}
+	else{
+		struct trienode *k = n->kids[i];
+		int m = 1;
+		while (m < k->len && m < len && k->label[m] == w[m]) m++;
+		if (m < k->len){
+			//the word leaves the edge part way along, so it needs a node there
+			struct trienode *mid = trieNew(k->label, m);
+			memmove(k->label, k->label + m, k->len - m);
+			k->len -= m;
+			k->label = memRealloc(k->label, k->len);
+			E.words.bytes -= m;
+			trieSetKids(mid, 1);
+			mid->kids[0] = k;
+			mid->best = k->best;
+			n->kids[i] = mid;
+			k = mid;
+		}
+		trieAdd(k, w + m, len - m);
+	}
+	if (n->kids[i]->best > n->best) n->best = n->kids[i]->best;
+}
+
+void trieRemove(struct trienode *n, const char *w, int len){
+	if (len == 0){
+		if (n->count > 0 && --n->count == 0) E.words.words--;
+	}
+	else{
+		int found;
+		int i = trieKid(n, w[0], &found);
+		if (!found) return;
+		struct trienode *k = n->kids[i];
+		if (k->len > len || memcmp(k->label, w, k->len)) return;
+		trieRemove(k, w + k->len, len - k->len);
+		if (k->count == 0 && k->nkids == 0){
+			trieFree(k);
+			memmove(&n->kids[i], &n->kids[i + 1], sizeof(struct trienode *) * (n->nkids - i - 1));
+			trieSetKids(n, n->nkids - 1);
+		}
+		else if (k->count == 0 && k->nkids == 1){
+			//no word ends here any more, so it folds into its only kid
+			struct trienode *only = k->kids[0];
+			only->label = memRealloc(only->label, k->len + only->len);
+			memmove(only->label + k->len, only->label, only->len);
+			memcpy(only->label, k->label, k->len);
+			only->len += k->len;
+			E.words.bytes += k->len;
+			trieFree(k);
+			n->kids[i] = only;
+		}
+	}
+	//counts only went down, so the best one has to be found again
+	n->best = n->count;
+	for (int i = 0; i < n->nkids; i++)
+		if (n->kids[i]->best > n->best) n->best = n->kids[i]->best;
+}
+
+//Feed every word of a row to fn
+void editorRowWords(erow *row, void (*fn)(struct trienode *, const char *, int)){
+	int j = 0;
+	while (j < row->size){
+		if (!isWordChar(row->chars[j])){
+			j++;
+			continue;
+		}
+		int s = j;
+		while (j < row->size && isWordChar(row->chars[j])) j++;
+		//numbers aren't words, and very short or long ones aren't worth completing
+		if (isdigit((unsigned char)row->chars[s]) || j - s < KILO_WORD_MIN || j - s > KILO_WORD_MAX) continue;
+		fn(E.words.root, &row->chars[s], j - s);
+	}
+}
+
+void editorWordsAddRow(erow *row){
+	if (!E.words.root || (row->flags & ROW_WORDS)) return;
+	editorRowWords(row, trieAdd);
+	row->flags |= ROW_WORDS;
+}
+
+void editorWordsRemoveRow(erow *row){
+	if (!(row->flags & ROW_WORDS)) return;
+	editorRowWords(row, trieRemove);
+	row->flags &= ~ROW_WORDS;
+}
+
+void editorWordsBuild(){
+	if (E.words.root) return;
+	E.words.root = trieNew("", 0);
+	for (int j = 0; j < E.numrows; j++) editorWordsAddRow(&E.row[j]);
+	//words from the other open buffers get offered too
+	for (int i = 0; i < E.nbufs; i++){
+		if (i == E.cur_buf) continue;
+		for (int j = 0; j < E.bufs[i].numrows; j++) editorWordsAddRow(&E.bufs[i].row[j]);
+	}
+}
+
+//Keep word (the first len bytes of buf) if it's among the most frequent so far
+void completionOffer(struct editorCompletion *c, const char *buf, int len, int count){
+	int at = c->count;
+	while (at > 0 && c->counts[at - 1] < count) at--;
+	if (at == KILO_COMPLETE_MAX) return;
+	int n = c->count < KILO_COMPLETE_MAX ? c->count : KILO_COMPLETE_MAX - 1;
+	memmove(&c->words[at + 1], &c->words[at], sizeof(c->words[0]) * (n - at));
+	memmove(&c->counts[at + 1], &c->counts[at], sizeof(c->counts[0]) * (n - at));
+	memcpy(c->words[at], buf, len);
+	c->words[at][len] = '\0';
+	c->counts[at] = count;
+	if (c->count < KILO_COMPLETE_MAX) c->count++;
+}
+
+//Collect the most frequent words under n, buf holds the word up to n. Kids go
+//in order of the best count under them, so the list fills with good words
+//early and whole subtrees that can't beat its worst entry get skipped
+void trieTop(struct trienode *n, char *buf, int len, int skip, struct editorCompletion *c){
+	if (n->count > 0 && len != skip) completionOffer(c, buf, len, n->count);
+	//a word char can't start more than 63 kids
+	unsigned long long tried = 0;
+	while (1){
+		int pick = -1;
+		for (int i = 0; i < n->nkids; i++)
+			if (!(tried >> i & 1) && (pick < 0 || n->kids[i]->best > n->kids[pick]->best)) pick = i;
+		if (pick < 0) break;
+		tried |= 1ULL << pick;
+		struct trienode *k = n->kids[pick];
+		if (c->count == KILO_COMPLETE_MAX && k->best <= c->counts[c->count - 1]) break;
+		memcpy(buf + len, k->label, k->len);
+		trieTop(k, buf, len + k->len, skip, c);
+	}
+}
+
+//Fill c with the most frequent words starting with prefix, leaving out the
+//prefix itself
+void editorWordsComplete(const char *prefix, int plen, struct editorCompletion *c){
+	char buf[KILO_WORD_MAX + 1];
+	struct trienode *n = E.words.root;
+	int len = 0;
+	c->count = 0;
+	while (len < plen){
+		int found;
+		int i = trieKid(n, prefix[len], &found);
+		if (!found) return;
+		struct trienode *k = n->kids[i];
+		int m = 0;
+		while (m < k->len && len + m < plen && k->label[m] == prefix[len + m]) m++;
+		//the prefix and the edge went different ways
+		if (m < k->len && len + m < plen) return;
+		memcpy(buf + len, k->label, k->len);
+		len += k->len;
+		n = k;
+	}
+	trieTop(n, buf, len, plen, c);
+}
+
+//Complete the word before the cursor with the most frequent match, pressing
+//it again straight away swaps in the next one
+void editorComplete(){
+	struct editorCompletion *c = &E.comp;
+	if (c->active && E.cy < E.numrows){
+		if (c->count < 2) return;
+		int extra = strlen(c->words[c->pick]) - c->prefix;
+		while (extra--) editorDelChar();
+		c->pick = (c->pick + 1) % c->count;
+	}
+	else{
+		if (E.cy >= E.numrows) return;
+		erow *row = &E.row[E.cy];
+		int at = E.cx - E.ln_length;
+		int s = at;
+		while (s > 0 && isWordChar(row->chars[s - 1])) s--;
+		if (s == at || at - s > KILO_WORD_MAX || isdigit((unsigned char)row->chars[s])){
+			editorSetStatusMessage("Nothing to complete");
+			return;
+		}
+		editorWordsBuild();
+		editorWordsComplete(&row->chars[s], at - s, c);
+		if (c->count == 0){
+			editorSetStatusMessage("No completions for %.*s", at - s, &row->chars[s]);
+			return;
+		}
+		c->prefix = at - s;
+		c->pick = 0;
+		c->active = 1;
+	}
+	for (char *p = c->words[c->pick] + c->prefix; *p; p++) editorInsertChar(*p);
+
+	char msg[sizeof(E.statusmsg)];
+	int len = 0;
+	for (int i = 0; i < c->count && len < (int)sizeof(msg); i++)
+		len += snprintf(msg + len, sizeof(msg) - len, i == c->pick ? "[%s] " : "%s ", c->words[i]);
+	editorSetStatusMessage("%s", msg);
+}
+
+/*** OUTLINE ***/
+
+//Functions, structs, unions, enums and typedefs defined in C files. Each
+//block keeps the ones that start in it, found by running the highlighted
+//tokens of its rows through a small state machine, and is only scanned again
+//after it changes. Symbols are kept with their bracket depth relative to the
+//start of the block, the depth at the start comes from the bracket index, so
+//a change further up doesn't make a block need scanning again
+
+const char *editorSymbolKinds[] = {"function", "struct", "union", "enum", "typedef"};
+
+//A construct the scanner has seen the start of but not the end
+struct symcandidate {
+	int state;
+	char name[KILO_SYMBOL_NAME];
+	int row, rx, depth;
+	//row the construct started on, it belongs to the block holding that
+	int start;
+	int kind;
+};
+
+struct symscan {
+	int depth;
+	//the last token was an identifier, and it's in ident
+	int after_ident;
+	struct symcandidate ident;
+	//a name followed by (, then the ) that closes it, then { or ;
+	struct symcandidate fn;
+	//struct/union/enum, then a name, then {
+	struct symcandidate tag;
+	//typedef up to the ; at the same depth. The name is the last identifier
+	//at that depth, or the first one in brackets for function pointers
+	struct symcandidate td;
+	struct symcandidate td_inner;
+	//the last row was a preprocessor line ending in a backslash
+	int pp_cont;
+};
+
+void editorBlockDropSymbols(struct rowblock *blk){
+	for (int i = 0; i < blk->nsyms; i++) memFree(blk->syms[i].name);
+	memFree(blk->syms);
+	blk->syms = NULL;
+	blk->nsyms = 0;
+}
+
+//Block b needs scanning again, and so does the one before it since its
+//constructs can run on into b
+void editorSymbolsDirty(int b){
+	E.blocks[b].syms_valid = 0;
+	if (b > 0) E.blocks[b - 1].syms_valid = 0;
+}
+
+//Row at is highlighted differently without its text changing
+void editorSymbolsChanged(int at){
+	if (E.nblocks == 0 || at >= E.numrows) return;
+	editorSymbolsDirty(editorBlockFind(at));
+}
+
+void symbolEmit(struct rowblock *blk, struct symcandidate *c, int kind){
+	if (c->start < blk->start || c->start >= blk->start + blk->nrows) return;
+	blk->syms = memRealloc(blk->syms, sizeof(struct symbol) * (blk->nsyms + 1));
+	struct symbol *s = &blk->syms[blk->nsyms++];
+	s->name = memStrdup(c->name);
+	s->row = c->row - blk->start;
+	s->rx = c->rx;
+	s->depth = c->depth;
+	s->kind = kind;
+}
+
+//One token: an identifier or keyword [i, end) of row j, or a single punctuation character
+void symbolToken(struct symscan *sc, struct rowblock *blk, erow *row, int i, int end, int cls){
+	char c = row->render[i];
+	int word = end > i + 1 || isWordChar(c);
+	if (word && (cls == HL_KEYWORD1 || cls == HL_KEYWORD2)){
+		int len = end - i;
+		int kind = -1;
+		if (len == 6 && !strncmp(&row->render[i], "struct", 6)) kind = SYM_STRUCT;
+		else if (len == 5 && !strncmp(&row->render[i], "union", 5)) kind = SYM_UNION;
+		else if (len == 4 && !strncmp(&row->render[i], "enum", 4)) kind = SYM_ENUM;
+		if (kind >= 0){
+			sc->tag.state = 1;
+			sc->tag.kind = kind;
+			sc->tag.start = row->idx;
+			sc->tag.depth = sc->depth;
+		}
+		else sc->tag.state = 0;
+		if (len == 7 && !strncmp(&row->render[i], "typedef", 7)){
+			sc->td.state = 1;
+			sc->td.start = row->idx;
+			sc->td.depth = sc->depth;
+			sc->td.name[0] = '\0';
+			sc->td_inner.name[0] = '\0';
+		}
+		sc->after_ident = 0;
+		return;
+	}
+	if (word){
+		if (isdigit((unsigned char)c)){
+			sc->after_ident = 0;
+			return;
+		}
+		struct symcandidate *id = &sc->ident;
+		int len = end - i < KILO_SYMBOL_NAME - 1 ? end - i : KILO_SYMBOL_NAME - 1;
+		memcpy(id->name, &row->render[i], len);
+		id->name[len] = '\0';
+		id->row = row->idx;
+		id->rx = i;
+		id->depth = sc->depth;
+		sc->after_ident = 1;
+		if (sc->tag.state == 1 && sc->depth == sc->tag.depth){
+			int kind = sc->tag.kind, start = sc->tag.start;
+			sc->tag = *id;
+			sc->tag.state = 2;
+			sc->tag.kind = kind;
+			sc->tag.start = start;
+			sc->tag.depth = sc->depth;
+		}
+		else sc->tag.state = 0;
+		if (sc->td.state){
+			if (sc->depth == sc->td.depth){
+				int start = sc->td.start;
+				sc->td = *id;
+				sc->td.state = 1;
+				sc->td.start = start;
+			}
+			else if (sc->depth == sc->td.depth + 1 && !sc->td_inner.name[0]) sc->td_inner = *id;
+		}
+		return;
+	}
+
+	switch (c){
+		case '(':
+			if (sc->after_ident && !sc->fn.state){
+				sc->fn = sc->ident;
+				sc->fn.state = 1;
+				sc->fn.start = sc->ident.row;
+			}
+			sc->depth++;
+			break;
+		case '[':
+			sc->depth++;
+			break;
+		case ')':
+		case ']':
+			sc->depth--;
+			if (sc->fn.state == 1 && sc->depth == sc->fn.depth) sc->fn.state = 2;
+			break;
+		case '{':
+			if (sc->fn.state == 2 && sc->depth == sc->fn.depth) symbolEmit(blk, &sc->fn, SYM_FUNCTION);
+			if (sc->tag.state == 2 && sc->depth == sc->tag.depth) symbolEmit(blk, &sc->tag, sc->tag.kind);
+			if (sc->fn.state != 1) sc->fn.state = 0;
+			sc->tag.state = 0;
+			sc->depth++;
+			break;
+		case '}':
+			sc->depth--;
+			if (sc->fn.state != 1) sc->fn.state = 0;
+			break;
+		case ';':
+			if (sc->td.state && sc->depth == sc->td.depth){
+				struct symcandidate *name = sc->td.name[0] ? &sc->td : &sc->td_inner;
+				if (name->name[0]){
+					name->start = sc->td.start;
+					name->depth = sc->td.depth;
+					symbolEmit(blk, name, SYM_TYPEDEF);
+				}
+				sc->td.state = 0;
+			}
+			if (sc->fn.state == 2) sc->fn.state = 0;
+			sc->tag.state = 0;
+			break;
+		case ',':
+		case '=':
+			if (sc->fn.state == 2) sc->fn.state = 0;
+			sc->tag.state = 0;
+			break;
+	}
+	sc->after_ident = 0;
+}
+
+//Feed a row's tokens to the scanner, leaving out strings and comments.
+//Preprocessor lines only get their brackets counted, to keep the depth in
+//step with the bracket index
+void symbolScanRow(struct symscan *sc, struct rowblock *blk, erow *row){
+	//not editorRowEnsureDerived, the rows shouldn't count as recently used
+	if (!(row->flags & ROW_DERIVED)){
+		editorRenderRow(row);
+		editorUpdateSyntax(row);
+	}
+	unsigned char *hl = editorDecodeHighlight(row);
+	int i = 0;
+	while (i < row->rsize && row->render[i] == ' ') i++;
+	int pp = sc->pp_cont || (i < row->rsize && row->render[i] == '#');
+	sc->pp_cont = pp && row->rsize > 0 && row->render[row->rsize - 1] == '\\';
+	for (; i < row->rsize; i++){
+		char c = row->render[i];
+		if (!bracketCounts(hl[i]) || c == ' ') continue;
+		if (pp){
+			if (bracketOpens(c)) sc->depth++;
+			else if (bracketCloses(c)) sc->depth--;
+			continue;
+		}
+		int end = i + 1;
+		if (isWordChar(c)) while (end < row->rsize && isWordChar(row->render[end]) && hl[end] == hl[i]) end++;
+		symbolToken(sc, blk, row, i, end, hl[i]);
+		i = end - 1;
+	}
+}
+
+//Find the symbols starting in block b, looking a little past its end for
+//how the last constructs finish
+void editorBlockSymbols(int b){
+	struct rowblock *blk = &E.blocks[b];
+	if (blk->syms_valid) return;
+	editorBlockDropSymbols(blk);
+	struct symscan sc;
+	memset(&sc, 0, sizeof(sc));
+	int end = blk->start + blk->nrows;
+	for (int j = blk->start; j < end; j++) symbolScanRow(&sc, blk, &E.row[j]);
+	for (int j = end; j < end + KILO_SYMBOL_LOOKAHEAD && j < E.numrows; j++){
+		if (!(sc.fn.state && sc.fn.start < end) && !(sc.tag.state == 2 && sc.tag.start < end) &&
+			!(sc.td.state && sc.td.start < end)) break;
+		symbolScanRow(&sc, blk, &E.row[j]);
+	}
+	blk->syms_valid = 1;
+	//scanning a lot of blocks in one go would blow through the cache budget otherwise
+	editorTrimDerived();
+}
+
+void editorBuildOutline(){
+	E.outline_len = 0;
+	//depth at the start of each block, going by the unmatched opens before it
+	struct bracketsum before = {0, 0};
+	for (int b = 0; b < E.nblocks; b++){
+		editorBlockSymbols(b);
+		struct rowblock *blk = &E.blocks[b];
+		for (int i = 0; i < blk->nsyms; i++){
+			struct symbol *s = &blk->syms[i];
+			if (before.open + s->depth > 0) continue;
+			if (E.outline_len == E.outline_cap){
+				E.outline_cap = E.outline_cap ? E.outline_cap * 2 : 64;
+				E.outline = memRealloc(E.outline, sizeof(struct outlineEntry) * E.outline_cap);
+			}
+			//copied, a reload while the prompt is up can replace the blocks
+			struct outlineEntry *o = &E.outline[E.outline_len++];
+			strcpy(o->name, s->name);
+			o->row = blk->start + s->row;
+			o->rx = s->rx;
+			o->kind = s->kind;
+		}
+		before = bracketJoin(before, editorBlockBrackets(b));
+	}
+}
+
+void editorOutlineCallback(char *query, int key){
+	if (key == '\r' || key == '\x1b') return;
+	int dir = 1;
+	int from = 0;
+	if (key == ARROW_DOWN || key == ARROW_RIGHT) from = E.outline_pick + 1;
+	else if (key == ARROW_UP || key == ARROW_LEFT){
+		from = E.outline_pick - 1;
+		dir = -1;
+	}
+	int n = E.outline_len;
+	for (int k = 0; k < n; k++){
+		int i = ((from + dir * k) % n + n) % n;
+		struct outlineEntry *o = &E.outline[i];
+		if (o->row >= E.numrows || !strstr(o->name, query)) continue;
+		E.outline_pick = i;
+		E.cy = o->row;
+		editorRowEnsureDerived(&E.row[o->row]);
+		E.cx = editorRowRenderToChars(&E.row[o->row], o->rx) + E.ln_length;
+		//put it at the top of the screen
+		E.rowoff = E.numrows;
+		return;
+	}
+}
+
+//Ctrl-G: pick a symbol by name and go to it
+void editorOutline(){
+	if (!E.syntax || !(E.syntax->flags & HL_OUTLINE)){
+		editorSetStatusMessage("No outline for this filetype");
+		return;
+	}
+	editorBuildOutline();
+	if (E.outline_len == 0){
+		editorSetStatusMessage("No symbols");
+		return;
+	}
+	int saved_cx = E.cx, saved_cy = E.cy;
+	int saved_coloff = E.coloff, saved_rowoff = E.rowoff;
+	char prompt[64];
+	snprintf(prompt, sizeof(prompt), "Symbol (%d): %%s (Use ESC/Arrows/Enter)", E.outline_len);
+	E.outline_pick = -1;
+	char *query = editorPrompt(prompt, editorOutlineCallback);
+	if (query){
+		if (E.outline_pick >= 0){
+			struct outlineEntry *o = &E.outline[E.outline_pick];
+			editorSetStatusMessage("%s %s, line %d", editorSymbolKinds[o->kind], o->name, o->row);
+		}
+		memFree(query);
+	}
+	else{
+		E.cx = saved_cx;
+		E.cy = saved_cy;
+		E.coloff = saved_coloff;
+		E.rowoff = saved_rowoff;
+	}
+}
+
+/*** FILTER ***/
+
+//Write as much of rows [*row, to] as the pipe takes right now. *off is how far
+//into *row (counting its newline) we already got. Returns -1 on a write error
+int filterWriteRows(int fd, int *row, int *off, int to){
+	struct iovec iov[KILO_FILTER_IOV];
+	int n = 0;
+	for (int j = *row; j <= to && n + 2 <= KILO_FILTER_IOV; j++){
+		int skip = (j == *row) ? *off : 0;
+		if (skip < E.row[j].size){
+			iov[n].iov_base = &E.row[j].chars[skip];
+			iov[n].iov_len = E.row[j].size - skip;
+			n++;
+		}
+		iov[n].iov_base = "\n";
+		iov[n].iov_len = 1;
+		n++;
+	}
+	ssize_t written = writev(fd, iov, n);
+	if (written < 0) return (errno == EAGAIN || errno == EINTR) ? 0 : -1;
+	while (written > 0){
+		int left = E.row[*row].size + 1 - *off;
+		if (written >= left){
+			written -= left;
+			(*row)++;
+			*off = 0;
+		}
+		else{
+			*off += written;
+			written = 0;
+		}
+	}
+	return 0;
+}
+
+//Start "sh -c cmd" with infd as its stdin and outfd as its stdout. Either
+//one that's -1 is a pipe instead, and the editor's end of it goes in *wfd or
+//*rfd, nonblocking. The command gets a process group of its own, so
+//filterKill can stop all of a pipeline. Returns the pid, or -1 with errno set
+pid_t filterSpawn(char *cmd, int infd, int outfd, int *wfd, int *rfd){
+	int in[2] = {-1, -1}, out[2] = {-1, -1};
+	if (infd == -1 && pipe(in) == -1) return -1;
+	if (outfd == -1 && pipe(out) == -1){
+		int err = errno;
+		if (in[0] != -1){
+			close(in[0]);
+			close(in[1]);
+		}
+		errno = err;
+		return -1;
+	}
+	pid_t pid = fork();
+	if (pid == -1){
+		int err = errno;
+		if (in[0] != -1){
+			close(in[0]);
+			close(in[1]);
+		}
+		if (out[0] != -1){
+			close(out[0]);
+			close(out[1]);
+		}
+		errno = err;
+		return -1;
+	}
+	if (pid == 0){
+		setpgid(0, 0);
+		dup2(infd != -1 ? infd : in[0], STDIN_FILENO);
+		dup2(outfd != -1 ? outfd : out[1], STDOUT_FILENO);
+		//anything it complains about would land on top of the editor
+		int null = open("/dev/null", O_WRONLY);
+		if (null != -1) dup2(null, STDERR_FILENO);
+		if (in[0] != -1){
+			close(in[0]);
+			close(in[1]);
+		}
+		if (out[0] != -1){
+			close(out[0]);
+			close(out[1]);
+		}
+		execl("/bin/sh", "sh", "-c", cmd, (char *)NULL);
+		_exit(127);
+	}
+	if (in[0] != -1){
+		close(in[0]);
+		*wfd = in[1];
+		fcntl(*wfd, F_SETFL, fcntl(*wfd, F_GETFL) | O_NONBLOCK);
+	}
+	if (out[0] != -1){
+		close(out[1]);
+		*rfd = out[0];
+		fcntl(*rfd, F_SETFL, fcntl(*rfd, F_GETFL) | O_NONBLOCK);
+	}
+	return pid;
+}
+
+//Write rows [from, to] to wfd and turn what comes back on rfd into rows in
+//output, at the same time so neither side can stall on a full pipe. Either fd
+//can be -1, and both are closed when it's done. With keys set a keypress
+//gives up on a command that never finishes, which is for the user's own
+//filters, not opening and saving. Returns -1 if writing failed, 1 if a key
+//was pressed
+int filterPump(int wfd, int from, int to, int rfd, struct newRows *output, int keys){
+	//a command that stops reading early shouldn't take the editor down with it
+	void (*old_pipe)(int) = signal(SIGPIPE, SIG_IGN);
+	char *buf = rfd != -1 ? memAlloc(KILO_FILTER_CHUNK) : NULL;
+	int wrow = from, woff = 0;
+	int failed = 0;
+	if (wfd != -1 && wrow > to){
+		close(wfd);
+		wfd = -1;
+	}
+	while (!failed && (wfd != -1 || rfd != -1)){
+		struct pollfd fds[3];
+		int nfds = 0;
+		//a replay script always has a key waiting, and can't mean to cancel anyway
+		if (keys && !E.headless){
+			fds[nfds].fd = E.infd;
+			fds[nfds].events = POLLIN;
+			nfds++;
+		}
+		if (wfd != -1){
+			fds[nfds].fd = wfd;
+			fds[nfds].events = POLLOUT;
+			nfds++;
+		}
+		if (rfd != -1){
+			fds[nfds].fd = rfd;
+			fds[nfds].events = POLLIN;
+			nfds++;
+		}
+		if (poll(fds, nfds, -1) == -1){
+			if (errno == EINTR) continue;
+			break;
+		}
+		for (int i = 0; i < nfds; i++){
+			if (!fds[i].revents) continue;
+			if (fds[i].fd == E.infd){
+				char c;
+				if (read(E.infd, &c, 1) == 1) failed = 2;
+			}
+			else if (fds[i].fd == wfd){
+				if (filterWriteRows(wfd, &wrow, &woff, to) == -1) failed = 1;
+				if (failed || wrow > to){
+					close(wfd);
+					wfd = -1;
+				}
+			}
+			else{
+				ssize_t n = read(rfd, buf, KILO_FILTER_CHUNK);
+				if (n > 0) newRowsTakeLines(output, buf, n);
+				else if (n == 0 || (errno != EAGAIN && errno != EINTR)){
+					close(rfd);
+					rfd = -1;
+				}
+			}
+		}
+	}
+	if (wfd != -1) close(wfd);
+	if (rfd != -1) close(rfd);
+	memFree(buf);
+	signal(SIGPIPE, old_pipe);
+	if (failed == 2) return 1;
+	return failed ? -1 : 0;
+}
+
+//Wait for pid and return its status
+int filterWait(pid_t pid){
+	int status;
+	while (waitpid(pid, &status, 0) == -1 && errno == EINTR);
+	return status;
+}
+
+//Stop the command started as pid, along with anything it started, and wait for it
+void filterKill(pid_t pid){
+	kill(-pid, SIGKILL);
+	filterWait(pid);
+}
+
+//Send rows [from, to] through "sh -c cmd" and replace them with what it prints.
+//The output is turned into rows as it arrives, and the rows are only replaced
+//if the command exits successfully
+void editorFilterRows(int from, int to, char *cmd){
+	int wfd, rfd;
+	pid_t pid = filterSpawn(cmd, -1, -1, &wfd, &rfd);
+	if (pid == -1){
+		editorSetStatusMessage("Filter failed: %s", strerror(errno));
+		return;
+	}
+
+	editorSetStatusMessage("Filtering through %s, press any key to cancel", cmd);
+	editorRefreshScreen();
+	unsigned long long start = nowNanos();
+	struct newRows output = {0};
+	if (filterPump(wfd, from, to, rfd, &output, 1) == 1){
+		filterKill(pid);
+		newRowsFree(&output);
+		editorSetStatusMessage("Filter cancelled, nothing changed");
+		return;
+	}
+	newRowsFinish(&output);
+
+	int status = filterWait(pid);
+	if (!WIFEXITED(status) || WEXITSTATUS(status) != 0){
+		newRowsFree(&output);
+		if (WIFEXITED(status))
+			editorSetStatusMessage("Filter exited with status %d, nothing changed", WEXITSTATUS(status));
+		else
+			editorSetStatusMessage("Filter was killed, nothing changed");
+		return;
+	}
+
+	int old = to - from + 1;
+	int n = output.n;
+	editorSpliceRows(from, old, &output);
+	E.dirty++;
+
+	E.cy = from < E.numrows ? from : E.numrows;
+	E.cx = E.ln_length;
+	E.mark_set = 0;
+	editorSetStatusMessage("%d line%s filtered into %d in %.1f ms", old, old == 1 ? "" : "s",
+		n, (nowNanos() - start) / 1e6);
+}
+
+/*** COMPRESSION ***/
+
+//Compressed files are read and written through the format's own command
+//line tool, run with the filter plumbing: its output is split into rows as
+//it streams in, and saving streams the rows into it straight out of E.row.
+//Neither way is there an uncompressed copy of the whole file on disk or in
+//memory, and the (de)compressing happens in the other process
+
+//The format a file starting with head is in, if it's one we know
+struct compressor *editorCompression(char *head, int len){
+	for (unsigned int k = 0; k < COMPRESSORS_ENTRIES; k++){
+		struct compressor *z = &COMPRESSORS[k];
+		if (len < z->magiclen) continue;
+		int i = 0;
+		while (i < z->magiclen && (z->magic[i] == '#' ? head[i] >= '1' && head[i] <= '9' : head[i] == z->magic[i]))
+			i++;
+		if (i == z->magiclen) return z;
+	}
+	return NULL;
+}
+
+struct compressor *editorFileCompression(int fd){
+	char head[16];
+	ssize_t n = pread(fd, head, sizeof(head), 0);
+	return n > 0 ? editorCompression(head, n) : NULL;
+}
+
+//Read what fd decompresses to with z into nr. Returns -1 with errno set if
+//the decompressor couldn't be run or failed
+int editorDecompress(int fd, struct compressor *z, struct newRows *nr){
+	int rfd;
+	lseek(fd, 0, SEEK_SET);
+	pid_t pid = filterSpawn(z->decompress, fd, -1, NULL, &rfd);
+	if (pid == -1) return -1;
+	filterPump(-1, 0, -1, rfd, nr, 0);
+	newRowsFinish(nr);
+	int status = filterWait(pid);
+	if (!WIFEXITED(status) || WEXITSTATUS(status) != 0){
+		newRowsFree(nr);
+		errno = EIO;
+		return -1;
+	}
+	return 0;
+}
+
+//Save through the compressor into an unlinked scratch file, then once it has
+//finished successfully copy that over the file in place the way editorSave
+//writes, so links, ownership and permissions stay as they were
+void editorSaveCompressed(){
+	struct compressor *z = E.compress;
+	FILE *tmp = tmpfile();
+	if (tmp == NULL){
+		editorSetStatusMessage("Can't save! I/0 error: %s", strerror(errno));
+		return;
+	}
+	int fd = fileno(tmp);
+	unsigned long long start = nowNanos();
+	int wfd;
+	pid_t pid = filterSpawn(z->compress, -1, fd, &wfd, NULL);
+	if (pid == -1){
+		editorSetStatusMessage("Can't save! %s: %s", z->name, strerror(errno));
+		fclose(tmp);
+		return;
+	}
+	int failed = filterPump(wfd, 0, E.numrows - 1, -1, NULL, 0) == -1;
+	int status = filterWait(pid);
+	struct stat st;
+	if (failed || !WIFEXITED(status) || WEXITSTATUS(status) != 0 || fstat(fd, &st) == -1){
+		editorSetStatusMessage("Can't save! %s failed, %s is unchanged", z->name, E.filename);
+		fclose(tmp);
+		return;
+	}
+
+	int out = open(E.filename, O_RDWR | O_CREAT, 0644);
+	if (out == -1 || ftruncate(out, st.st_size) == -1){
+		editorSetStatusMessage("Can't save! I/0 error: %s", strerror(errno));
+		if (out != -1) close(out);
+		fclose(tmp);
+		return;
+	}
+	char *buf = memAlloc(KILO_FILTER_CHUNK);
+	for (off_t off = 0; off < st.st_size; ){
+		ssize_t n = pread(fd, buf, KILO_FILTER_CHUNK, off);
+		if (n <= 0 || pwrite(out, buf, n, off) != n){
+			editorSetStatusMessage("Can't save! I/0 error: %s", strerror(errno));
+			memFree(buf);
+			close(out);
+			fclose(tmp);
+			return;
+		}
+		off += n;
+	}
+	memFree(buf);
+	fclose(tmp);
+	//so the watch can tell this write apart from someone else's
+	fstat(out, &E.file_stat);
+	close(out);
+	E.dirty = 0;
+	editorSetStatusMessage("%d lines written to disk with %s, %ld bytes in %.1f ms", E.numrows,
+		z->name, (long)st.st_size, (nowNanos() - start) / 1e6);
+}
+
+/*** OPEN CACHE ***/
+
+//Opening a big file spends nearly all of its time highlighting every row, just
+//to find out which rows end inside a comment and where the brackets are. So
+//the first open writes that down for each block in a cache file, along with
+//where every line starts, and the next one takes the rows straight from the
+//line index and leaves every block cold: only the comment state it ends in and
+//its bracket summary are set, its rows are highlighted the first time one of
+//them is needed (see editorBlockWarm). A cache is used only while the file has
+//the same size, mtime, inode and sampled contents as when it was written.
+//Using one touches it, and saving one prunes the directory back under
+//KILO_CACHE_MAX_BYTES from the least recently used end
+
+struct cacheHeader {
+	char magic[8];
+	int64_t size;
+	int64_t mtime_sec;
+	int64_t mtime_nsec;
+	uint64_t dev;
+	uint64_t ino;
+	uint64_t sample;
+	int32_t syntax;
+	int32_t numrows;
+	int32_t nblocks;
+	int32_t pad;
+};
+
+//The header is followed by an int64_t for where each row starts in the file,
+//then one of these for each block
+struct cacheBlock {
+	int32_t nrows;
+	int32_t open_comment;
+	int32_t br_open;
+	int32_t br_close;
+};
+
+//Where the cache for filename goes, under $XDG_CACHE_HOME or ~/.cache and
+//named after a hash of the file's full path. create makes the directories.
+//NULL if there's nowhere for it
+char *editorCachePath(char *filename, int create){
+	char real[PATH_MAX];
+	if (!realpath(filename, real)) return NULL;
+	char *base = getenv("XDG_CACHE_HOME");
+	char *home = getenv("HOME");
+	char dir[PATH_MAX];
+	if (base && base[0]) snprintf(dir, sizeof(dir), "%s/kilo", base);
+	else if (home && home[0]) snprintf(dir, sizeof(dir), "%s/.cache/kilo", home);
+	else return NULL;
+	if (create){
+		char *slash = strrchr(dir, '/');
+		*slash = '\0';
+		mkdir(dir, 0700);
+		*slash = '/';
+		mkdir(dir, 0700);
+	}
+	char *path = memAlloc(strlen(dir) + 32);
+	sprintf(path, "%s/%016llx", dir, (unsigned long long)blockHashBytes(real, strlen(real)));
+	return path;
+}
+
+//Hash of KILO_CACHE_SAMPLES pieces spread evenly over the file, plus its end
+uint64_t editorCacheSample(char *data, long size){
+	struct blockhash bh;
+	blockHashInit(&bh);
+	for (int k = 0; k <= KILO_CACHE_SAMPLES; k++){
+		long off = k < KILO_CACHE_SAMPLES ? size / KILO_CACHE_SAMPLES * k : size - KILO_CACHE_SAMPLE_BYTES;
+		if (off < 0) off = 0;
+		long len = size - off < KILO_CACHE_SAMPLE_BYTES ? size - off : KILO_CACHE_SAMPLE_BYTES;
+		blockHashUpdate(&bh, data + off, len);
+	}
+	return blockHashFinal(&bh);
+}
+
+//Everything a cache has to match to be used for the file st describes
+void editorCacheKey(struct cacheHeader *h, struct stat *st, char *data){
+	memset(h, 0, sizeof(*h));
+	memcpy(h->magic, KILO_CACHE_MAGIC, sizeof(h->magic));
+	h->size = st->st_size;
+	h->mtime_sec = st->st_mtim.tv_sec;
+	h->mtime_nsec = st->st_mtim.tv_nsec;
+	h->dev = st->st_dev;
+	h->ino = st->st_ino;
+	h->sample = editorCacheSample(data, st->st_size);
+	h->syntax = E.syntax ? E.syntax - HLDB : -1;
+}
+
+//Fill the empty current buffer with the rows of the len byte cache at map.
+//data is the file st describes, mapped. Returns 0 without touching anything
+//if the cache doesn't match it or doesn't add up
+int editorCacheApply(char *map, long len, struct stat *st, char *data){
+	struct cacheHeader key, h;
+	memcpy(&h, map, sizeof(h));
+	editorCacheKey(&key, st, data);
+	if (memcmp(&h, &key, offsetof(struct cacheHeader, numrows))) return 0;
+	long n = h.numrows, nb = h.nblocks;
+	if (n <= 0 || nb <= 0 || len != (long)(sizeof(h) + n * sizeof(int64_t) + nb * sizeof(struct cacheBlock)))
+		return 0;
+	int64_t *starts = (int64_t *)(map + sizeof(h));
+	struct cacheBlock *cb = (struct cacheBlock *)(starts + n);
+	long size = st->st_size;
+	long rows = 0;
+	for (long b = 0; b < nb; b++){
+		if (cb[b].nrows <= 0) return 0;
+		rows += cb[b].nrows;
+	}
+	if (rows != n || starts[0] != 0) return 0;
+	//each row but the first has to start just past a newline
+	for (long i = 1; i < n; i++)
+		if (starts[i] <= starts[i - 1] || starts[i] > size || data[starts[i] - 1] != '\n') return 0;
+	long end = data[size - 1] == '\n' ? size - 1 : size;
+	if (starts[n - 1] > end) return 0;
+
+	editorOpenRows(0, n);
+	for (long i = 0; i < n; i++){
+		long from = starts[i];
+		long to = i + 1 < n ? starts[i + 1] - 1 : end;
+		//the same as newRowsAdd
+		if (to > from && data[to - 1] == '\r') to--;
+		erow *row = &E.row[i];
+		row->size = to - from;
+		row->chars = rowTextAlloc(row->size);
+		memcpy(row->chars, data + from, row->size);
+		row->chars[row->size] = '\0';
+	}
+	//the blocks go back to how they were when the cache was written, each
+	//one's last row holding the comment state it ends in
+	for (int b = 0; b < E.nblocks; b++) editorBlockDropSymbols(&E.blocks[b]);
+	E.blocks = memRealloc(E.blocks, sizeof(struct rowblock) * nb);
+	memset(E.blocks, 0, sizeof(struct rowblock) * nb);
+	int start = 0;
+	for (long b = 0; b < nb; b++){
+		struct rowblock *blk = &E.blocks[b];
+		blk->start = start;
+		blk->nrows = cb[b].nrows;
+		blk->br.open = cb[b].br_open;
+		blk->br.close = cb[b].br_close;
+		blk->br_valid = 1;
+		blk->cold = 1;
+		start += blk->nrows;
+		E.row[start - 1].hl_open_comment = cb[b].open_comment;
+	}
+	E.nblocks = nb;
+	E.cold_blocks = nb;
+	E.offsets_from = 0;
+	E.br_stale = 1;
+	E.br_ndirty = 0;
+	E.br_hint = 0;
+	return 1;
+}
+
+//Fill the empty current buffer from its cache if there's one for filename
+//that still matches it. data is the file st describes, mapped
+int editorCacheLoad(char *filename, struct stat *st, char *data){
+	if (st->st_size < KILO_CACHE_MIN_BYTES) return 0;
+	char *path = editorCachePath(filename, 0);
+	if (!path) return 0;
+	int fd = open(path, O_RDONLY);
+	memFree(path);
+	if (fd == -1) return 0;
+	struct stat cst;
+	char *map = MAP_FAILED;
+	if (fstat(fd, &cst) == 0 && cst.st_size >= (off_t)sizeof(struct cacheHeader))
+		map = mmap(NULL, cst.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (map == MAP_FAILED){
+		close(fd);
+		return 0;
+	}
+	int ok = editorCacheApply(map, cst.st_size, st, data);
+	munmap(map, cst.st_size);
+	//its mtime is when it was last used, for editorCachePrune
+	if (ok) futimens(fd, NULL);
+	close(fd);
+	if (ok) E.open_cache_hits++;
+	return ok;
+}
+
+struct cacheEntry {
+	time_t used;
+	off_t size;
+	char name[32];
+};
+
+int cacheEntryCmp(const void *a, const void *b){
+	time_t x = ((const struct cacheEntry *)a)->used, y = ((const struct cacheEntry *)b)->used;
+	return (x > y) - (x < y);
+}
+
+//Delete the least recently used caches in the directory path is in until the
+//rest add up to no more than KILO_CACHE_MAX_BYTES
+void editorCachePrune(char *path){
+	char dir[strlen(path) + 1];
+	strcpy(dir, path);
+	*strrchr(dir, '/') = '\0';
+	DIR *d = opendir(dir);
+	if (!d) return;
+	struct cacheEntry *ents = NULL;
+	int n = 0, cap = 0;
+	long total = 0;
+	struct dirent *de;
+	while ((de = readdir(d)) != NULL){
+		struct stat st;
+		if (strlen(de->d_name) >= sizeof(ents->name) ||
+			fstatat(dirfd(d), de->d_name, &st, AT_SYMLINK_NOFOLLOW) == -1 || !S_ISREG(st.st_mode))
+			continue;
+		if (n == cap){
+			cap = cap ? cap * 2 : 64;
+			ents = memRealloc(ents, sizeof(struct cacheEntry) * cap);
+		}
+		ents[n].used = st.st_mtime;
+		ents[n].size = st.st_size;
+		strcpy(ents[n].name, de->d_name);
+		total += st.st_size;
+		n++;
+	}
+	if (total > KILO_CACHE_MAX_BYTES){
+		qsort(ents, n, sizeof(struct cacheEntry), cacheEntryCmp);
+		for (int i = 0; i < n && total > KILO_CACHE_MAX_BYTES; i++)
+			if (unlinkat(dirfd(d), ents[i].name, 0) == 0) total -= ents[i].size;
+	}
+	closedir(d);
+	memFree(ents);
+}
+
+//Write the cache for filename from the current buffer, which has to hold
+//exactly the file st describes. data is that file's contents, it's only
+//looked at for where each row ends and for the samples
+void editorCacheSave(char *filename, struct stat *st, char *data){
+	if (st->st_size < KILO_CACHE_MIN_BYTES || E.numrows == 0 || E.stale_rows) return;
+	long size = st->st_size;
+	int64_t *starts = memAlloc(sizeof(int64_t) * E.numrows);
+	long pos = 0;
+	for (int j = 0; j < E.numrows && pos <= size; j++){
+		starts[j] = pos;
+		pos += E.row[j].size;
+		if (pos < size && data[pos] == '\r') pos++;
+		pos++;
+	}
+	//the rows aren't what's in the file
+	if (pos != size && pos != size + 1){
+		memFree(starts);
+		return;
+	}
+	struct cacheBlock *cb = memAlloc(sizeof(struct cacheBlock) * E.nblocks);
+	for (int b = 0; b < E.nblocks; b++){
+		struct rowblock *blk = &E.blocks[b];
+		struct bracketsum br = editorBlockBrackets(b);
+		cb[b].nrows = blk->nrows;
+		cb[b].open_comment = E.row[blk->start + blk->nrows - 1].hl_open_comment;
+		cb[b].br_open = br.open;
+		cb[b].br_close = br.close;
+	}
+	struct cacheHeader h;
+	editorCacheKey(&h, st, data);
+	h.numrows = E.numrows;
+	h.nblocks = E.nblocks;
+
+	char *path = editorCachePath(filename, 1);
+	if (path){
+		//written next to where it goes and renamed over it, so a cache is
+		//never seen half written
+		char tmp[strlen(path) + 8];
+		snprintf(tmp, sizeof(tmp), "%s.XXXXXX", path);
+		int fd = mkstemp(tmp);
+		FILE *fp = fd == -1 ? NULL : fdopen(fd, "w");
+		if (fp){
+			int ok = fwrite(&h, sizeof(h), 1, fp) == 1 &&
+				fwrite(starts, sizeof(int64_t), E.numrows, fp) == (size_t)E.numrows &&
+				fwrite(cb, sizeof(struct cacheBlock), E.nblocks, fp) == (size_t)E.nblocks;
+			if (fclose(fp) != 0) ok = 0;
+			if (!ok || rename(tmp, path) == -1) unlink(tmp);
+			else editorCachePrune(path);
+		}
+		else if (fd != -1){
+			close(fd);
+			unlink(tmp);
+		}
+		memFree(path);
+	}
+	memFree(cb);
+	memFree(starts);
+}
+
+/*** COMMANDS ***/
+
+//Parse a line address at *p: a line number, '.' for the cursor's line or '$'
+//for the last one, then any number of +n/-n. Returns 0 if there isn't one
+int editorParseAddress(char **p, int *line){
+	char *s = *p;
+	if (*s == '.'){
+		*line = E.cy;
+		s++;
+	}
+	else if (*s == '$'){
+		*line = E.numrows - 1;
+		s++;
+	}
+	else if (isdigit((unsigned char)*s)){
+		*line = strtol(s, &s, 10);
+	}
+	else if (*s == '+' || *s == '-'){
+		*line = E.cy;
+	}
+	else{
+		return 0;
+	}
+	while (*s == '+' || *s == '-'){
+		int sign = (*s == '-') ? -1 : 1;
+		s++;
+		int n = isdigit((unsigned char)*s) ? strtol(s, &s, 10) : 1;
+		*line += sign * n;
+	}
+	*p = s;
+	return 1;
 }
 
-/*** FIND ***/
-
-void editorFindCallback(char *query, int key){
-	static int last_match = -1;
-	static int direction = 1;
-
-	static int saved_hl_line;
-	static char *saved_hl = NULL;
-	//If we have a stored highlighted_line, restored that before we do anything else
-	if (saved_hl) {
-		//Can use saved_hl_line as index because file not modifiable in find state. will need to change if
-		//that functionality is modified
-		memcpy(E.row[saved_hl_line].hl, saved_hl, E.row[saved_hl_line].rsize);
-		free(saved_hl);
-		saved_hl = NULL;
-	}	
-	//Finish if we press escape and reset everything
-	if (key == '\r' || key == '\x1b'){
-		last_match = -1;
-		direction = 1;
-		return;
+//Parse the range in front of a command: '%' for every line, one address, or two
+//separated by a comma. Without one it's the selection if there is one, else the
+//cursor's line. An empty file's range is empty, from 0 to -1. Returns 0 if the
+//range is outside the file
+int editorParseRange(char **p, int *from, int *to){
+	int r0, c0, r1, c1;
+	if (**p == '%'){
+		(*p)++;
+		*from = 0;
+		*to = E.numrows - 1;
 	}
-	//Find next instance
-	else if (key == ARROW_RIGHT || key == ARROW_DOWN){
-		direction = 1;
+	else if (editorParseAddress(p, from)){
+		*to = *from;
+		if (**p == ','){
+			(*p)++;
+			if (!editorParseAddress(p, to)) return 0;
+		}
 	}
-	//Find previous instance
-	else if (key == ARROW_LEFT || key == ARROW_UP){
-		direction = -1;
+	else if (editorSelection(&r0, &c0, &r1, &c1)){
+		*from = r0;
+		*to = r1;
 	}
 	else{
-		last_match = -1;
-		direction = 1;
+		*from = *to = E.cy;
+	}
+	if (*from > *to){
+		int t = *from;
+		*from = *to;
+		*to = t;
 	}
+	//there are no lines to go by, but filtering can still put its output in
+	if (E.numrows == 0 && *from >= -1 && *to <= 0){
+		*from = 0;
+		*to = -1;
+		return 1;
+	}
+	return *from >= 0 && *to < E.numrows;
+}
 
-	if (last_match == -1) direction = 1;
-	int current = last_match;
-	//match cursor to next instance of the query string
-	int i;
-	for (i = 0; i < E.numrows; i++){
-		current += direction;
-		if (current == -1) current = E.numrows - 1;
-		else if (current == E.numrows) current = 0;
-		//See if our query is a substring of the current row
-		erow *row = &E.row[current];
-		char *match = strstr(row->render, query);
-		if (match){
-			last_match = current;
-			E.cy = current;
-			E.cx = editorRowRxToCx(row, match - row->render);
-			E.rowoff = E.numrows;
-			//Save the non-highlighted text so we can restore the line when we exit the find state
-			saved_hl_line = current;
-			saved_hl = malloc(row->rsize);
-			memcpy(saved_hl, row->hl, row->rsize);
-			//Highlight the matching part of the text
-			memset(&row->hl[match - row->render], HL_MATCH, strlen(query));
-			break;
-		}
+//Put the cursor at the start of a row, with the row in the middle of the screen
+void editorGotoRow(int row){
+	if (row > E.numrows - 1) row = E.numrows - 1;
+	if (row < 0) row = 0;
+	E.cy = row;
+	E.cx = E.ln_length;
+	E.rowoff = row - E.screenrows / 2;
+	if (E.rowoff < 0) E.rowoff = 0;
+}
+
+//Go pct percent of the way into the file by bytes, so it lands in the same
+//place a percentage through the file on disk would
+void editorGotoPercent(int pct){
+	if (pct > 100) pct = 100;
+	long off = editorFileSize() * pct / 100;
+	editorGotoRow(editorRowAtOffset(off));
+}
+
+//Buffer commands: "e file", "b" for the last buffer or "b N|name", "bn",
+//"bp", "bd" (or "bd!" to drop changes), "ls" and "hex [file]" to open a file,
+//or the current one, in the hex view. Returns 0 if p isn't one
+int editorBufferCommand(char *p){
+	char *arg = p;
+	while (*arg && !isspace((unsigned char)*arg)) arg++;
+	int n = arg - p;
+	while (isspace((unsigned char)*arg)) arg++;
+	if (n == 1 && *p == 'e'){
+		if (*arg == '\0') editorSetStatusMessage("No file name");
+		else editorBufferOpen(arg, 0);
+	}
+	else if (n == 3 && !strncmp(p, "hex", 3)){
+		char *name = *arg ? arg : E.filename;
+		if (name == NULL) editorSetStatusMessage("No file name");
+		else editorBufferOpen(name, 1);
 	}
+	else if (n == 1 && *p == 'b'){
+		int i = E.alt_buf;
+		if (*arg != '\0') i = editorBufferLookup(arg);
+		else if (i == -1) editorSetStatusMessage("No other buffer");
+		if (i != -1) editorBufferSwitch(i);
+	}
+	else if (n == 2 && !strncmp(p, "bn", 2)) editorBufferSwitch((E.cur_buf + 1) % E.nbufs);
+	else if (n == 2 && !strncmp(p, "bp", 2)) editorBufferSwitch((E.cur_buf + E.nbufs - 1) % E.nbufs);
+	else if (n == 2 && !strncmp(p, "bd", 2)) editorBufferClose(0);
+	else if (n == 3 && !strncmp(p, "bd!", 3)) editorBufferClose(1);
+	else if (n == 2 && !strncmp(p, "ls", 2)) editorBufferList();
+	else return 0;
+	return 1;
 }
 
-void editorFind(){
-	int saved_cx = E.cx;
-	int saved_cy = E.cy;
-	int saved_coloff = E.coloff;
-	int saved_rowoff = E.rowoff;
+//Window commands: "sp" or "split" and "vs" or "vsplit", either with a file
+//to open in the new window, "close" and "only". Returns 0 if p isn't one
+int editorWindowCommand(char *p){
+	char *arg = p;
+	while (*arg && !isspace((unsigned char)*arg)) arg++;
+	int n = arg - p;
+	while (isspace((unsigned char)*arg)) arg++;
+	int how = 0;
+	if ((n == 2 && !strncmp(p, "sp", 2)) || (n == 5 && !strncmp(p, "split", 5))) how = WIN_ROWS;
+	else if ((n == 2 && !strncmp(p, "vs", 2)) || (n == 6 && !strncmp(p, "vsplit", 6))) how = WIN_COLS;
+	else if (n == 5 && !strncmp(p, "close", 5)) editorWindowClose();
+	else if (n == 4 && !strncmp(p, "only", 4)) editorWindowOnly();
+	else return 0;
+	if (how && editorWindowSplit(how) && *arg != '\0') editorBufferOpen(arg, 0);
+	return 1;
+}
 
-	char *query = editorPrompt("Search: %s (Use ESC/Arrows/Enter)", editorFindCallback);
-	if (query){
-		free(query);
+//Run an ex style command line, like "%!sort" or ".,+10!clang-format", or
+//just a line number or percentage to go to
+void editorCommand(char *cmd){
+	char *p = cmd;
+	while (isspace((unsigned char)*p)) p++;
+	if (E.hex && editorHexCommand(p)) return;
+	int from, to;
+	char *range = p;
+	int inrange = editorParseRange(&p, &from, &to);
+	int given = p != range;
+	while (isspace((unsigned char)*p)) p++;
+	if (*p == '\0'){
+		if (given) editorGotoRow(to);
+		return;
 	}
-	else{
-		E.cx = saved_cx;
-		E.cy = saved_cy;
-		E.coloff = saved_coloff;
-		E.rowoff = saved_rowoff;
+	if (given && !strcmp(p, "%")){
+		editorGotoPercent(to);
+		return;
+	}
+	if (*p == '!'){
+		if (!inrange){
+			editorSetStatusMessage("Range is outside the file");
+			return;
+		}
+		p++;
+		while (isspace((unsigned char)*p)) p++;
+		if (*p == '\0') editorSetStatusMessage("No command to filter through");
+		else editorFilterRows(from, to, p);
+		return;
+	}
+	if (editorBufferCommand(p) || editorWindowCommand(p)) return;
+	if (!strcmp(p, "follow")){
+		editorToggleFollow();
+		return;
+	}
+	if (!strncmp(p, "stats", 5) && (p[5] == '\0' || isspace((unsigned char)p[5]))){
+		char *path = p + 5;
+		while (isspace((unsigned char)*path)) path++;
+		if (*path == '\0') editorShowStats(STATS_MEMORY);
+		else if (editorMemoryDump(path) == 0) editorSetStatusMessage("Memory stats written to %s", path);
+		else editorSetStatusMessage("Can't write %s: %s", path, strerror(errno));
+		return;
 	}
+	editorSetStatusMessage("Unknown command: %s", p);
+}
+
+void editorCommandPrompt(){
+	char *cmd = editorPrompt(":%s", NULL);
+	if (cmd == NULL) return;
+	editorCommand(cmd);
+	memFree(cmd);
 }
 
 /*** APPEND BUFFER ***/
@@ -764,7 +5581,7 @@ struct abuf {
 //append a new string to the existing buffer
 void abAppend(struct abuf *ab, const char *s, int len){
 	//allocate new space for what we're appending
-	char *new = realloc(ab->b, ab->len + len);
+	char *new = memRealloc(ab->b, ab->len + len);
 
 	if(new == NULL) return;
 	//concat the existing string and the new string 's'
@@ -775,12 +5592,16 @@ void abAppend(struct abuf *ab, const char *s, int len){
 
 //deallocate the memory used by ab
 void abFree(struct abuf *ab){
-	free(ab->b);
+	memFree(ab->b);
 }
 
 /*** OUTPUT ***/
 
 void editorScroll(){
+	if (E.hex){
+		editorHexScroll();
+		return;
+	}
 	//Get length of rendered row
 	E.rx = 0;
 	if(E.cy < E.numrows){
@@ -812,19 +5633,200 @@ void configureLNLength(){
 	E.ln_length = lineNumLen + 1;
 }
 
-void editorDrawRows(struct abuf *ab){
+//Draw len characters that all share the highlight class hl
+void editorDrawSpan(struct abuf *ab, char *c, int len, int hl, int *current_color){
+	//make normal characters normal (waow)
+	int color = (hl == HL_NORMAL) ? -1 : editorSyntaxToColor(hl);
+	if (color != *current_color){
+		char buf[16];
+		int clen = (color == -1) ? snprintf(buf, sizeof(buf), "\x1b[39m") :
+			snprintf(buf, sizeof(buf), "\x1b[%dm", color);
+		abAppend(ab, buf, clen);
+		*current_color = color;
+	}
+	int j = 0;
+	while (j < len){
+		//append runs of printable characters in one go
+		int run = j;
+		while (run < len){
+			unsigned char b = c[run];
+			if (b < 0x80){
+				if (iscntrl(b)) break;
+				run++;
+				continue;
+			}
+			//multibyte characters go out as they are, unless they're broken
+			//or one of the C1 control characters
+			int cp;
+			int n = utf8Decode(&c[run], len - run, &cp);
+			if (cp < 0xa0) break;
+			run += n;
+		}
+		if (run > j) abAppend(ab, &c[j], run - j);
+		if (run == len) break;
+
+		int cp;
+		int n = utf8Decode(&c[run], len - run, &cp);
+		char sym = (cp >= 0 && cp <= 26) ? '@' + cp : '?';
+		abAppend(ab, "\x1b[7m", 4);
+		abAppend(ab, &sym, 1);
+		abAppend(ab, "\x1b[m", 3);
+		if (*current_color != -1){
+			char buf[16];
+			int clen = snprintf(buf, sizeof(buf), "\x1b[%dm", *current_color);
+			abAppend(ab, buf, clen);
+		}
+		j = run + n;
+	}
+}
+
+//Byte offset in render of the character at chars offset at
+int editorRowCharsToRender(erow *row, int at){
+	if (!(row->flags & ROW_OWNS_RENDER)) return at;
+	int idx = 0, col = 0, j = 0;
+	while (j < at && j < row->size){
+		if (row->chars[j] == '\t'){
+			idx += KILO_TAB_STOP - (col % KILO_TAB_STOP);
+			col += KILO_TAB_STOP - (col % KILO_TAB_STOP);
+			j++;
+			continue;
+		}
+		int n = 1;
+		if (row->flags & ROW_ASCII) col++;
+		else col += utf8Width(&row->chars[j], row->size - j, &n);
+		idx += n;
+		j += n;
+	}
+	return idx;
+}
+
+//Work out which bytes of a row's render fit in the columns [coloff, coloff+cols).
+//If a wide character is cut in half by the left edge, *pad is how many blank
+//columns to draw in its place
+void editorRenderClip(erow *row, int coloff, int cols, int *start, int *end, int *pad){
+	*pad = 0;
+	if (row->flags & ROW_ASCII){
+		*start = coloff < row->rsize ? coloff : row->rsize;
+		*end = coloff + cols < row->rsize ? coloff + cols : row->rsize;
+		return;
+	}
+	int i = 0, col = 0, n;
+	while (i < row->rsize && col < coloff){
+		col += utf8Width(&row->render[i], row->rsize - i, &n);
+		i += n;
+	}
+	//skip combining marks that belonged to a character we didn't draw
+	while (i < row->rsize && utf8Width(&row->render[i], row->rsize - i, &n) == 0) i += n;
+	if (col > coloff) *pad = col - coloff;
+	*start = i;
+	col = *pad;
+	while (i < row->rsize){
+		int w = utf8Width(&row->render[i], row->rsize - i, &n);
+		if (col + w > cols) break;
+		col += w;
+		i += n;
+	}
+	*end = i;
+}
+
+//A window that doesn't reach the right edge can't erase to the end of the
+//line, and one that doesn't start at the left has to be moved to every line
+void editorDrawLineStart(struct abuf *ab, struct editorWindow *w, int y){
+	int edge = w->left + w->cols >= E.termcols;
+	int whole = edge && w->left == 0;
+	if (!whole || (y == 0 && w->top > 0)){
+		char pos[32];
+		int plen = snprintf(pos, sizeof(pos), "\x1b[%d;%dH", w->top + y + 1, w->left + 1);
+		abAppend(ab, pos, plen);
+		if (!edge){
+			plen = snprintf(pos, sizeof(pos), "\x1b[%dX", w->cols);
+			abAppend(ab, pos, plen);
+		}
+	}
+}
+
+void editorDrawLineEnd(struct abuf *ab, struct editorWindow *w){
+	int edge = w->left + w->cols >= E.termcols;
+	//erase what's currently in each line as we draw the rows
+	if (edge) abAppend(ab, "\x1b[K", 3);
+	if (edge && w->left == 0) abAppend(ab, "\r\n", 2);
+}
+
+//The hex view's rows: the offset, the bytes in hex and then as ASCII, with
+//the byte under the cursor inverted on the ASCII side
+void editorHexDrawRows(struct abuf *ab, struct editorWindow *w){
+	struct editorHex *h = E.hex;
+	w->drawn_ln = E.ln_length;
+	long rows = editorHexRows(h);
+	long cur = (long)E.cy * KILO_HEX_COLS + (E.cx - E.ln_length) / 2;
+	for (int y = 0; y < E.screenrows; y++){
+		editorDrawLineStart(ab, w, y);
+		long r = E.rowoff + (long)y;
+		if (r >= rows){
+			abAppend(ab, "~", 1);
+			editorDrawLineEnd(ab, w);
+			continue;
+		}
+		long off = r * KILO_HEX_COLS;
+		int n = h->size - off < KILO_HEX_COLS ? h->size - off : KILO_HEX_COLS;
+		char line[128];
+		int len = snprintf(line, sizeof(line), "%0*lx  ", h->digits, off);
+		for (int i = 0; i < KILO_HEX_COLS; i++){
+			if (i < n) len += snprintf(line + len, sizeof(line) - len, "%02x ", h->map[off + i]);
+			else len += snprintf(line + len, sizeof(line) - len, "   ");
+			if (i == KILO_HEX_COLS / 2 - 1) line[len++] = ' ';
+		}
+		line[len++] = '|';
+		int ascii = len;
+		for (int i = 0; i < n; i++){
+			unsigned char c = h->map[off + i];
+			line[len++] = c >= 32 && c < 127 ? c : '.';
+		}
+		line[len++] = '|';
+		if (len > E.screencols) len = E.screencols;
+		int at = w == E.win && cur >= off && cur < off + n ? ascii + (cur - off) : len;
+		if (at < len){
+			abAppend(ab, line, at);
+			abAppend(ab, "\x1b[7m", 4);
+			abAppend(ab, &line[at], 1);
+			abAppend(ab, "\x1b[27m", 5);
+			abAppend(ab, &line[at + 1], len - at - 1);
+		}
+		else{
+			abAppend(ab, line, len);
+		}
+		editorDrawLineEnd(ab, w);
+	}
+}
+
+//Draw the rows of window w, whose view is in E while it's being drawn
+void editorDrawRows(struct abuf *ab, struct editorWindow *w){
+	if (E.hex){
+		editorHexDrawRows(ab, w);
+		return;
+	}
 	int y;
 	configureLNLength();
+	w->drawn_ln = E.ln_length;
+	int r0, c0, r1, c1;
+	//the selection and the matching bracket only show in the current window
+	int selected = w == E.win && editorSelection(&r0, &c0, &r1, &c1);
+	int match_cy = w == E.win ? E.match_cy : -1;
+	//the gutter comes out of the window's width
+	int textcols = E.screencols - E.ln_length;
+	if (textcols < 0) textcols = 0;
 	for (y = 0; y < E.screenrows; y++) {
 		int filerow = y + E.rowoff;
+		editorDrawLineStart(ab, w, y);
 
 		//Construct the line number  (format #### |)
-		char lnString[E.ln_length + 1];
+		//the ~ rows past the end can have more digits than ln_length allows for
+		char lnString[E.ln_length + 16];
 		sprintf(lnString, "%d", filerow);
 		const char *padding = "                                                   ";
 		int padLen = (E.ln_length-1) - strlen(lnString);
 		if (padLen < 0) padLen = 0;
-		char lnPrint[E.ln_length + 1];
+		char lnPrint[E.ln_length + 16];
 		sprintf(lnPrint, "%s%*.*s|", lnString, padLen, padLen, padding);
 		abAppend(ab, lnPrint, E.ln_length);
 		if (filerow >= E.numrows){
@@ -834,9 +5836,9 @@ void editorDrawRows(struct abuf *ab){
 				char welcome[80];
 				int welcomelen = snprintf(welcome, sizeof(welcome),
 					"Kilo editor -- version %s", KILO_VERSION);
-				if (welcomelen > E.screencols) welcomelen = E.screencols;
+				if (welcomelen > textcols) welcomelen = textcols;
 				//Append padding to center the message in the middle of the screen
-				int padding = (E.screencols - welcomelen) / 2;
+				int padding = (textcols - welcomelen) / 2;
 				if (padding){
 					abAppend(ab, "~", 1);
 					padding--;
@@ -849,52 +5851,318 @@ void editorDrawRows(struct abuf *ab){
 			}
 		}
 		else{
-			int len = E.row[filerow].rsize - E.coloff;
-			if (len < 0) len = 0;
-			if (len > E.screencols) len = E.screencols;
-			char *c = &E.row[filerow].render[E.coloff];
-			unsigned char *hl = &E.row[filerow].hl[E.coloff];
+			erow *row = &E.row[filerow];
+			editorRowEnsureDerived(row);
+			int start, end, pad;
+			editorRenderClip(row, E.coloff, textcols, &start, &end, &pad);
+			while (pad--) abAppend(ab, " ", 1);
 			//store the current color so we don't have to put an escape sequence every time
 			int current_color = -1;
-			//iterate through characters to render to adjust for syntax highlighting
-			int j;
-			for (j = 0; j < len; j++){
-				if (iscntrl(c[j])) {
-					char sym = (c[j] <= 26) ? '@' + c[j] : '?';
-					abAppend(ab, "\x1b[7m", 4);
-					abAppend(ab, &sym, 1);
-					abAppend(ab, "\x1b[m", 3);
-					if (current_color != -1){
-						char buf[16];
-						int clen = snprintf(buf, sizeof(buf), "\x1b[%dm", current_color);
-						abAppend(ab, buf, clen);
-					}	
-				}
-				//make normal characters normal (waow)
-				else if (hl[j] == HL_NORMAL){
-					if (current_color != -1){
-						abAppend(ab, "\x1b[39m", 5);
-						current_color = -1;
-					}
-					abAppend(ab, &c[j], 1);
-				}
-				//print the color escape sequence into the row before the character
-				else{
-					int color = editorSyntaxToColor(hl[j]);
-					if (color != current_color){
-						current_color = color;
-						char buf[16];
-						int clen = snprintf(buf, sizeof(buf), "\x1b[%dm", color);
-						abAppend(ab, buf, clen);
+			//render bytes [self, selto) are selected and drawn inverted, and so
+			//is the bracket matching the one under the cursor
+			int self = 0, selto = 0, insel = 0;
+			if (selected && filerow >= r0 && filerow <= r1){
+				self = (filerow == r0) ? editorRowCharsToRender(row, c0) : 0;
+				selto = (filerow == r1) ? editorRowCharsToRender(row, c1) : row->rsize;
+			}
+			int match = (filerow == match_cy) ? E.match_rx : -1;
+			//walk the highlight spans, drawing whatever part of each one is on screen
+			int col = 0;
+			int s;
+			for (s = 0; s < row->hlcount && col < end; s++){
+				int spanend = col + row->hl[s].len;
+				int from = col > start ? col : start;
+				int to = spanend < end ? spanend : end;
+				//split the span wherever that starts and stops
+				while (from < to){
+					int sel = (from >= self && from < selto) || from == match;
+					int piece = to;
+					int cuts[4] = {self, selto, match, match + 1};
+					for (int k = 0; k < 4; k++)
+						if (cuts[k] > from && cuts[k] < piece) piece = cuts[k];
+					if (sel != insel){
+						abAppend(ab, sel ? "\x1b[7m" : "\x1b[27m", sel ? 4 : 5);
+						insel = sel;
 					}
-					abAppend(ab, &c[j], 1);
+					editorDrawSpan(ab, &row->render[from], piece - from, row->hl[s].hl, &current_color);
+					from = piece;
 				}
+				col = spanend;
 			}
+			if (insel) abAppend(ab, "\x1b[27m", 5);
 			abAppend(ab, "\x1b[39m", 5);
 		}
-		//erase what's currently in each line as we draw the rows
+		editorDrawLineEnd(ab, w);
+	}
+}
+
+//Draw window w. One that isn't current is drawn by lending E its view, and
+//its buffer too if that isn't the current one
+void editorDrawWindow(struct abuf *ab, struct editorWindow *w){
+	if (w == E.win){
+		editorDrawRows(ab, w);
+		return;
+	}
+	struct editorBuffer *cur = &E.bufs[E.cur_buf];
+	struct editorBuffer *other = w->buf != E.cur_buf ? &E.bufs[w->buf] : NULL;
+	int rowoff = E.rowoff, coloff = E.coloff;
+	int rows = E.screenrows, cols = E.screencols;
+	int other_rowoff = 0, other_coloff = 0;
+	if (other){
+		editorBufferStash(cur);
+		editorBufferLoad(other);
+		other_rowoff = other->rowoff;
+		other_coloff = other->coloff;
+	}
+	E.rowoff = w->rowoff;
+	E.coloff = w->coloff;
+	E.screenrows = w->rows;
+	E.screencols = w->cols;
+	editorDrawRows(ab, w);
+	if (other){
+		//highlighting the rows can have touched its blocks
+		editorBufferStash(other);
+		other->rowoff = other_rowoff;
+		other->coloff = other_coloff;
+		editorBufferLoad(cur);
+	}
+	E.rowoff = rowoff;
+	E.coloff = coloff;
+	E.screenrows = rows;
+	E.screencols = cols;
+}
+
+//The line under a window saying what's in it, the current window's is bold
+void editorDrawWindowStatus(struct abuf *ab, struct editorWindow *w){
+	char *name = w->buf == E.cur_buf ? E.filename : E.bufs[w->buf].filename;
+	int dirty = w->buf == E.cur_buf ? E.dirty : E.bufs[w->buf].dirty;
+	char pos[32], status[80];
+	int len = snprintf(pos, sizeof(pos), "\x1b[%d;%dH", w->top + w->rows + 1, w->left + 1);
+	abAppend(ab, pos, len);
+	abAppend(ab, w == E.win ? "\x1b[1;7m" : "\x1b[7m", w == E.win ? 6 : 4);
+	len = snprintf(status, sizeof(status), " %.60s%s", name ? name : "[No Name]", dirty ? " [+]" : "");
+	if (len > w->cols) len = w->cols;
+	abAppend(ab, status, len);
+	for (; len < w->cols; len++) abAppend(ab, " ", 1);
+	abAppend(ab, "\x1b[m", 3);
+}
+
+//The column between side by side windows
+void editorDrawSeparators(struct abuf *ab, struct editorWindow *w){
+	if (w->split == WIN_LEAF) return;
+	if (w->split == WIN_COLS){
+		for (int y = 0; y < w->rows; y++){
+			char pos[32];
+			int len = snprintf(pos, sizeof(pos), "\x1b[%d;%dH|", w->top + y + 1, w->left + w->kids[0]->cols + 1);
+			abAppend(ab, pos, len);
+		}
+	}
+	editorDrawSeparators(ab, w->kids[0]);
+	editorDrawSeparators(ab, w->kids[1]);
+}
+
+//Draw the current window, the others whose rows on screen have changed
+//since they were drawn, and the status lines that could have changed
+void editorDrawWindows(struct abuf *ab){
+	configureLNLength();
+	int relayout = 0;
+	struct editorWindow *w;
+	for (w = editorWindowFirst(E.win_root); w; w = editorWindowAfter(w))
+		if (!w->drawn_ln) relayout = 1;
+	for (w = editorWindowFirst(E.win_root); w; w = editorWindowAfter(w)){
+		int stale = !w->drawn_ln || (w->buf == E.cur_buf &&
+			(w->drawn_ln != E.ln_length || E.damage_from < w->rowoff + w->rows));
+		if (w == E.win || stale) editorDrawWindow(ab, w);
+		if (E.nwins > 1 && (w == E.win || stale || w->buf == E.cur_buf)) editorDrawWindowStatus(ab, w);
+	}
+	if (relayout) editorDrawSeparators(ab, E.win_root);
+	E.damage_from = INT_MAX;
+}
+
+//What the rows of one or more buffers take up, counted row by row
+struct rowBytes {
+	int rows;
+	long row_array;
+	long chars;
+	long render;
+	long hl;
+	long blocks;
+};
+
+//Where the memory goes: every buffer's rows counted one by one, with the
+//current buffer's share, the rest from the numbers kept as they're allocated
+struct memReport {
+	struct rowBytes total;
+	struct rowBytes cur;
+	long trie;
+	int frame;
+	int frame_peak;
+	unsigned long allocs;
+	unsigned long reallocs;
+	unsigned long frees;
+	long peak_rss_kb;
+};
+
+//Add a buffer's rows, blocks and bracket tree to rb
+void memCountRows(struct rowBytes *rb, erow *rows, int n, int nblocks, int br_size){
+	rb->rows += n;
+	rb->row_array += (long)n * sizeof(erow);
+	//text shared between rows is counted for each of them
+	for (int j = 0; j < n; j++){
+		erow *row = &rows[j];
+		rb->chars += sizeof(struct rowtext) + row->size + 1;
+		if (row->flags & ROW_OWNS_RENDER) rb->render += row->rsize + 1;
+		rb->hl += sizeof(hlspan) * row->hlcount;
+	}
+	rb->blocks += (long)nblocks * sizeof(struct rowblock) + 2L * br_size * sizeof(struct bracketsum);
+}
+
+void editorMemoryReport(struct memReport *m){
+	memset(m, 0, sizeof(*m));
+	memCountRows(&m->cur, E.row, E.numrows, E.nblocks, E.br_size);
+	m->total = m->cur;
+	for (int i = 0; i < E.nbufs; i++){
+		struct editorBuffer *b = &E.bufs[i];
+		if (i != E.cur_buf) memCountRows(&m->total, b->row, b->numrows, b->nblocks, b->br_size);
+	}
+	m->trie = E.words.bytes;
+	m->frame = E.last_frame_bytes;
+	m->frame_peak = E.peak_frame_bytes;
+	m->allocs = E.mem_allocs;
+	m->reallocs = E.mem_reallocs;
+	m->frees = E.mem_frees;
+	struct rusage ru;
+	//in kilobytes on Linux
+	if (getrusage(RUSAGE_SELF, &ru) == 0) m->peak_rss_kb = ru.ru_maxrss;
+}
+
+//Write the memory report as "name value" lines, so runs of different builds
+//can be compared with diff or a script. The row figures are for every
+//buffer, the cur_ ones the current buffer's share of them
+int editorMemoryDump(const char *path){
+	FILE *fp = fopen(path, "w");
+	if (!fp) return -1;
+	struct memReport m;
+	editorMemoryReport(&m);
+	fprintf(fp, "buffers %d\n", E.nbufs);
+	fprintf(fp, "rows %d\n", m.total.rows);
+	fprintf(fp, "row_array_bytes %ld\n", m.total.row_array);
+	fprintf(fp, "chars_bytes %ld\n", m.total.chars);
+	fprintf(fp, "render_bytes %ld\n", m.total.render);
+	fprintf(fp, "hl_bytes %ld\n", m.total.hl);
+	fprintf(fp, "block_bytes %ld\n", m.total.blocks);
+	fprintf(fp, "cur_rows %d\n", m.cur.rows);
+	fprintf(fp, "cur_row_array_bytes %ld\n", m.cur.row_array);
+	fprintf(fp, "cur_chars_bytes %ld\n", m.cur.chars);
+	fprintf(fp, "cur_render_bytes %ld\n", m.cur.render);
+	fprintf(fp, "cur_hl_bytes %ld\n", m.cur.hl);
+	fprintf(fp, "cur_block_bytes %ld\n", m.cur.blocks);
+	fprintf(fp, "trie_bytes %ld\n", m.trie);
+	fprintf(fp, "frame_bytes %d\n", m.frame);
+	fprintf(fp, "frame_peak_bytes %d\n", m.frame_peak);
+	fprintf(fp, "allocs %lu\n", m.allocs);
+	fprintf(fp, "reallocs %lu\n", m.reallocs);
+	fprintf(fp, "frees %lu\n", m.frees);
+	fprintf(fp, "live_allocs %ld\n", (long)(m.allocs - m.frees));
+	fprintf(fp, "peak_rss_kb %ld\n", m.peak_rss_kb);
+	fclose(fp);
+	return 0;
+}
+
+int editorMemoryLines(char lines[][80]){
+	struct memReport m;
+	editorMemoryReport(&m);
+	int n = 0;
+	char title[40];
+	snprintf(title, sizeof(title), "Rows in all %d buffer%s", E.nbufs, E.nbufs == 1 ? "" : "s");
+	snprintf(lines[n++], 80, "%-27s(current buffer)", title);
+	snprintf(lines[n++], 80, "  rows:      %-14d (%d)", m.total.rows, m.cur.rows);
+	snprintf(lines[n++], 80, "  erow:      %-14ld (%ld) bytes", m.total.row_array, m.cur.row_array);
+	snprintf(lines[n++], 80, "  chars:     %-14ld (%ld) bytes", m.total.chars, m.cur.chars);
+	snprintf(lines[n++], 80, "  render:    %-14ld (%ld) bytes", m.total.render, m.cur.render);
+	snprintf(lines[n++], 80, "  hl:        %-14ld (%ld) bytes", m.total.hl, m.cur.hl);
+	snprintf(lines[n++], 80, "  blocks:    %-14ld (%ld) bytes", m.total.blocks, m.cur.blocks);
+	snprintf(lines[n++], 80, " ");
+	snprintf(lines[n++], 80, "Elsewhere");
+	snprintf(lines[n++], 80, "  trie:      %ld bytes", m.trie);
+	snprintf(lines[n++], 80, "  frame:     %d bytes, %d at most", m.frame, m.frame_peak);
+	snprintf(lines[n++], 80, " ");
+	snprintf(lines[n++], 80, "Allocations since startup");
+	snprintf(lines[n++], 80, "  allocs:    %lu", m.allocs);
+	snprintf(lines[n++], 80, "  reallocs:  %lu", m.reallocs);
+	snprintf(lines[n++], 80, "  frees:     %lu (%ld live)", m.frees, (long)(m.allocs - m.frees));
+	snprintf(lines[n++], 80, "  peak RSS:  %ld KB", m.peak_rss_kb);
+	return n;
+}
+
+int editorGeneralLines(char lines[][80]){
+	int n = 0;
+	int cached = 0, shared = 0;
+	for (int j = 0; j < E.numrows; j++){
+		if (E.row[j].flags & ROW_DERIVED) cached++;
+		if (ROWTEXT(E.row[j].chars)->refs > 1) shared++;
+	}
+	unsigned long lookups = E.cache_hits + E.cache_misses;
+
+	snprintf(lines[n++], 80, "Row render/highlight cache");
+	snprintf(lines[n++], 80, "  budget:    %ld bytes", E.derived_budget);
+	snprintf(lines[n++], 80, "  in use:    %ld bytes", E.derived_bytes);
+	snprintf(lines[n++], 80, "  rows:      %d of %d cached", cached, E.numrows);
+	snprintf(lines[n++], 80, "  hits:      %lu", E.cache_hits);
+	snprintf(lines[n++], 80, "  misses:    %lu (%.1f%%)", E.cache_misses,
+		lookups ? 100.0 * E.cache_misses / lookups : 0.0);
+	snprintf(lines[n++], 80, "  evictions: %lu", E.cache_evictions);
+	snprintf(lines[n++], 80, " ");
+	snprintf(lines[n++], 80, "Row text");
+	snprintf(lines[n++], 80, "  register:  %d lines", E.reg.count);
+	snprintf(lines[n++], 80, "  shared:    %d rows", shared);
+	snprintf(lines[n++], 80, "  copies:    %lu made on write", E.cow_copies);
+	snprintf(lines[n++], 80, "  blocks:    %d, %d cold", E.nblocks, E.cold_blocks);
+	snprintf(lines[n++], 80, " ");
+	long text = editorBufferBytes();
+	int cold = 0;
+	for (int i = 0; i < E.nbufs; i++){
+		if (i == E.cur_buf) continue;
+		text += E.bufs[i].bytes;
+		cold += E.bufs[i].cold;
+	}
+	snprintf(lines[n++], 80, "Buffers");
+	snprintf(lines[n++], 80, "  open:      %d, %d let go", E.nbufs, cold);
+	snprintf(lines[n++], 80, "  text:      %ld bytes of %ld budget", text, E.memory_budget);
+	snprintf(lines[n++], 80, "  reloads:   %lu", E.buf_reloads);
+	snprintf(lines[n++], 80, "  cached:    %lu opens", E.open_cache_hits);
+	snprintf(lines[n++], 80, " ");
+	snprintf(lines[n++], 80, "Completion trie");
+	if (E.words.root){
+		snprintf(lines[n++], 80, "  words:     %ld distinct", E.words.words);
+		snprintf(lines[n++], 80, "  nodes:     %ld, %ld bytes", E.words.nodes, E.words.bytes);
+	}
+	else snprintf(lines[n++], 80, "  not built yet (Ctrl-N builds it)");
+	snprintf(lines[n++], 80, " ");
+	snprintf(lines[n++], 80, "Timing (usec)     count        p50        p99        max");
+	for (int ph = 0; ph < PH_COUNT; ph++){
+		struct latency *l = &E.phase_latency[ph];
+		snprintf(lines[n++], 80, "  %-8s %12lu %10.1f %10.1f %10.1f", editorPhaseNames[ph], l->count,
+			latencyPercentile(l, 50) / 1000.0, latencyPercentile(l, 99) / 1000.0, l->max / 1000.0);
+	}
+	return n;
+}
+
+//Full screen page of internal numbers, shown in place of the rows
+void editorDrawStats(struct abuf *ab){
+	char lines[48][80];
+	int n = E.stats_view == STATS_MEMORY ? editorMemoryLines(lines) : editorGeneralLines(lines);
+
+	//it covers every window
+	editorWindowsInvalidate();
+	for (int y = 0; y < E.termrows; y++){
+		if (y < n){
+			int len = strlen(lines[y]);
+			if (len > E.termcols) len = E.termcols;
+			abAppend(ab, lines[y], len);
+		}
 		abAppend(ab, "\x1b[K", 3);
-		abAppend(ab, "\r\n", 2);			
+		abAppend(ab, "\r\n", 2);
 	}
 }
 
@@ -902,22 +6170,39 @@ void editorDrawStatusBar(struct abuf *ab){
 	//Switches to inverted color formatting
 	abAppend(ab, "\x1b[7m", 4);
 	//row status, NOT render status lol
-	char status[80], posstatus[80], rstatus[80];
+	char status[80], posstatus[80], rstatus[80], bufstatus[32] = "";
+	//which buffer this is, once there's more than one
+	if (E.nbufs > 1) snprintf(bufstatus, sizeof(bufstatus), "[%d/%d] ", E.cur_buf + 1, E.nbufs);
+	char ztag[16] = "";
+	if (E.compress) snprintf(ztag, sizeof(ztag), "[%s]", E.compress->name);
 	//Print the filename or a default if there isn't a file
-	int len = snprintf(status, sizeof(status), "%.20s - %d lines %s",
+	int len = snprintf(status, sizeof(status), "%s%.20s - %d lines %s%s%s", bufstatus,
 		E.filename ? E.filename : "[No Name]", E.numrows,
-		E.dirty ? "(modified)" : "");
+		E.dirty ? "(modified)" : "", E.follow_fd != -1 ? "[follow]" : "", ztag);
 	//Display no ft if E.syntax is NULL
 	int rlen = snprintf(rstatus, sizeof(rstatus), "%s | %d/%d",
 		E.syntax ? E.syntax->filetype : "no ft", E.cy, E.numrows);
-	if (len > E.screencols) len = E.screencols;
-	int poslen = snprintf(posstatus, sizeof(posstatus), " || X: %d | Y: %d",
+	if (E.hex){
+		long off = (long)E.cy * KILO_HEX_COLS + (E.cx - E.ln_length) / 2;
+		len = snprintf(status, sizeof(status), "%s%.20s - %ld bytes %s%s", bufstatus,
+			E.filename, E.hex->size, E.dirty ? "(modified)" : "", E.hex->writable ? "[hex]" : "[hex, read only]");
+		rlen = snprintf(rstatus, sizeof(rstatus), "hex | 0x%lx/0x%lx", off, E.hex->size);
+	}
+	//The perf HUD takes over the right hand side when it's on
+	if (E.perf_hud){
+		rlen = snprintf(rstatus, sizeof(rstatus), "frame %.2fms | %dB | p99 key %.2fms",
+			E.last_frame_ns / 1e6, E.last_frame_bytes,
+			latencyPercentile(&E.phase_latency[PH_KEY], 99) / 1e6);
+	}
+	if (len > E.termcols) len = E.termcols;
+	//the offset on the right says where the hex view's cursor is
+	int poslen = E.hex ? 0 : snprintf(posstatus, sizeof(posstatus), " || X: %d | Y: %d",
 		E.cx - E.ln_length, E.cy);
 	abAppend(ab, status, len);
 	abAppend(ab, posstatus, poslen);
 	//Fill with empty spaces
-	while (len+poslen < E.screencols){
-		if (E.screencols - (len+poslen) == rlen){
+	while (len+poslen < E.termcols){
+		if (E.termcols - (len+poslen) == rlen){
 			abAppend(ab, rstatus, rlen);
 			break;
 		}
@@ -933,14 +6218,24 @@ void editorDrawStatusBar(struct abuf *ab){
 void editorDrawMessageBar(struct abuf *ab){
 	abAppend(ab, "\x1b[K", 3);
 	int msglen = strlen(E.statusmsg);
-	if (msglen > E.screencols) msglen = E.screencols;
+	if (msglen > E.termcols) msglen = E.termcols;
 	if (msglen && time(NULL) - E.statusmsg_time < 5)
 		abAppend(ab, E.statusmsg, msglen);
 }
 
 void editorRefreshScreen(){
+	//there's one frame at the end of a macro instead of one per key
+	if (E.macro_playing) return;
+	unsigned long long frame_start = nowNanos();
 	//Scroll the text if the cursor is offscreen
 	editorScroll();
+	int mcy, mrx;
+	E.match_cy = -1;
+	if (E.cy < E.numrows && editorMatchBracket(E.cy,
+		editorRowCharsToRender(&E.row[E.cy], E.cx - E.ln_length), &mcy, &mrx)){
+		E.match_cy = mcy;
+		E.match_rx = mrx;
+	}
 
 	struct abuf ab = ABUF_INIT;
 	//Hide the cursor while we're repainting the terminal
@@ -948,22 +6243,40 @@ void editorRefreshScreen(){
 	//H repositions the cursor, default is (1, 1) which is what we want
 	abAppend(&ab, "\x1b[H", 3);
 
-	editorDrawRows(&ab);
+	unsigned long long draw_start = nowNanos();
+	if (E.stats_view) editorDrawStats(&ab);
+	else editorDrawWindows(&ab);
+	editorPhaseEnd(PH_DRAW, draw_start);
 	//Stupid little check to make sure our cursor isn't in the line numbers
 	if(E.cx < E.ln_length) E.cx = E.ln_length;
 
+	//with one window the last row ends right above the status bar
+	if (E.nwins > 1 && !E.stats_view){
+		char pos[32];
+		int len = snprintf(pos, sizeof(pos), "\x1b[%d;1H", E.termrows + 1);
+		abAppend(&ab, pos, len);
+	}
 	editorDrawStatusBar(&ab);
 	editorDrawMessageBar(&ab);
 
 	//Move the cursor to the current stored position
 	char buf[32];
-	snprintf(buf, sizeof(buf), "\x1b[%d;%dH", (E.cy - E.rowoff) + 1, (E.rx - E.coloff) + 1);
+	snprintf(buf, sizeof(buf), "\x1b[%d;%dH", (E.cy - E.rowoff) + E.win->top + 1,
+		(E.rx - E.coloff) + E.win->left + 1);
 	abAppend(&ab, buf, strlen(buf));
 
 	abAppend(&ab, "\x1b[?25h", 6);
 
-	write(STDOUT_FILENO, ab.b, ab.len);
+	unsigned long long write_start = nowNanos();
+	write(E.outfd, ab.b, ab.len);
+	editorPhaseEnd(PH_WRITE, write_start);
+	E.last_frame_bytes = ab.len;
+	if (ab.len > E.peak_frame_bytes) E.peak_frame_bytes = ab.len;
 	abFree(&ab);
+	E.last_frame_ns = editorPhaseEnd(PH_FRAME, frame_start);
+
+	//Now that the visible rows are marked as used, make room if we need to
+	editorTrimDerived();
 }
 
 void editorSetStatusMessage(const char *fmt, ...){
@@ -978,7 +6291,7 @@ void editorSetStatusMessage(const char *fmt, ...){
 
 char *editorPrompt(char *prompt, void (*callback)(char *, int)){
 	size_t bufsize = 128;
-	char *buf = malloc(bufsize);
+	char *buf = memAlloc(bufsize);
 
 	size_t buflen = 0;
 	buf[0] = '\0';
@@ -994,7 +6307,7 @@ char *editorPrompt(char *prompt, void (*callback)(char *, int)){
 		else if (c == '\x1b'){
 			editorSetStatusMessage("");
 			if (callback) callback(buf, c);
-			free(buf);
+			memFree(buf);
 			return NULL;
 		}
 		else if (c == '\r'){
@@ -1007,7 +6320,7 @@ char *editorPrompt(char *prompt, void (*callback)(char *, int)){
 		else if (!iscntrl(c) && c < 128){
 			if (buflen == bufsize - 1){
 				bufsize *= 2;
-				buf = realloc(buf, bufsize);
+				buf = memRealloc(buf, bufsize);
 			}
 			buf[buflen++] = c;
 			buf[buflen] = '\0';
@@ -1016,6 +6329,16 @@ char *editorPrompt(char *prompt, void (*callback)(char *, int)){
 	}
 }
 
+//Show the stats page until the next keypress
+void editorShowStats(int page){
+	E.stats_view = page;
+	editorSetStatusMessage("Press any key to return");
+	editorRefreshScreen();
+	editorReadKey();
+	E.stats_view = 0;
+	editorSetStatusMessage("");
+}
+
 void editorMoveCursor(int key){
 	//check if the cursor is on an actual line
 	erow *row = (E.cy >= E.numrows) ? NULL : &E.row[E.cy];
@@ -1024,7 +6347,8 @@ void editorMoveCursor(int key){
 	switch (key) {
 		case ARROW_LEFT:
 			if(E.cx > E.ln_length){
-				E.cx--;
+				if (row->flags & ROW_ASCII) E.cx--;
+				else E.cx = utf8Prev(row->chars, row->size, E.cx - E.ln_length) + E.ln_length;
 			}
 			//If at beginning of row, move to the end of the row above this one
 			else if (E.cy > 0){
@@ -1035,7 +6359,8 @@ void editorMoveCursor(int key){
 		case ARROW_RIGHT:
 			//check if cursor is to the left of the end of the current line
 			if (row && E.cx < row->size + E.ln_length){
-				E.cx++;
+				if (row->flags & ROW_ASCII) E.cx++;
+				else E.cx = utf8Next(row->chars, row->size, E.cx - E.ln_length) + E.ln_length;
 			}
 			else if (row && E.cx == row->size + E.ln_length){
 				E.cy++;
@@ -1060,27 +6385,144 @@ void editorMoveCursor(int key){
 	if (E.cx > rowlen){
 		E.cx = rowlen;
 	}
+	//Don't leave the cursor in the middle of a multibyte character
+	if (row && !(row->flags & ROW_ASCII)){
+		while (E.cx - E.ln_length > 0 && E.cx - E.ln_length < row->size &&
+			((unsigned char)row->chars[E.cx - E.ln_length] & 0xc0) == 0x80) E.cx--;
+	}
 	//Correct x pos if it is in the line number
 	if (E.cx < E.ln_length) E.cx = E.ln_length;
 }
 
+//Move a page (times count) at once, ending up where that many arrow presses would
+void editorPage(int key, int count){
+	long target;
+	if (key == PAGE_UP) target = (long)E.rowoff - (long)E.screenrows * count;
+	else target = (long)E.rowoff + E.screenrows - 1 + (long)E.screenrows * count;
+	if (target < 0) target = 0;
+	if (target > E.numrows) target = E.numrows;
+	E.cy = target;
+	//a zero length move still snaps x to the new row
+	editorMoveCursor(0);
+}
+
+//Ctrl-U starts a count: read digits until some other key comes along, which
+//is the command the count is for. *key gets that command
+int editorReadCount(int *key){
+	int count = 0;
+	while (1){
+		editorSetStatusMessage("Count: %d", count);
+		editorRefreshScreen();
+		int c = editorReadKey();
+		if (c >= '0' && c <= '9'){
+			count = count * 10 + (c - '0');
+			if (count > KILO_MAX_COUNT) count = KILO_MAX_COUNT;
+		}
+		else if (c == BACKSPACE || c == CTRL_KEY('h')){
+			count /= 10;
+		}
+		else{
+			editorSetStatusMessage("");
+			*key = c;
+			return count > 0 ? count : 1;
+		}
+	}
+}
+
+//Insert the character c (and the rest of it, if it's a multibyte one) count times
+void editorInsertRepeated(int c, int count){
+	char ch[4];
+	int n = 1;
+	ch[0] = c;
+	if (c >= 0xc0 && c < 0xe0) n = 2;
+	else if (c >= 0xe0 && c < 0xf0) n = 3;
+	else if (c >= 0xf0 && c < 0xf8) n = 4;
+	for (int i = 1; i < n; i++) ch[i] = editorReadKey();
+	if (count > INT_MAX / n){
+		editorSetStatusMessage("Count too big");
+		return;
+	}
+	char *buf = memAlloc((size_t)n * count);
+	if (buf == NULL){
+		editorSetStatusMessage("Not enough memory to insert %d characters", count);
+		return;
+	}
+	for (int i = 0; i < count; i++) memcpy(&buf[(size_t)i * n], ch, n);
+	editorInsertText(buf, n * count);
+	memFree(buf);
+}
+
 void editorProcessKeypress(){
 	static int quit_times = KILO_QUIT_TIMES;
 
 	int c = editorReadKey();
+	int count = 1;
+	int counted = 0;
+	if (c == CTRL_KEY('u')){
+		count = editorReadCount(&c);
+		counted = 1;
+	}
+	//any other key ends cycling through completions
+	if (c != CTRL_KEY('n')) E.comp.active = 0;
+	unsigned long long start = nowNanos();
+
+	//the hex view has keys of its own, anything it passes on works as usual
+	if (E.hex && editorHexKey(c, count)){
+		quit_times = KILO_QUIT_TIMES;
+		editorPhaseEnd(PH_INPUT, start);
+		return;
+	}
 
 	switch (c) {
 		case '\r':
-			editorInsertNewline();
+			while (count--) editorInsertNewline();
+			break;
+		case CTRL_KEY('k'):
+			editorDeleteLines(count);
+			break;
+		case CTRL_KEY('j'):
+			editorJoinLines(count);
+			break;
+		case CTRL_KEY('b'):
+			E.mark_set = !E.mark_set;
+			E.mark_cx = E.cx;
+			E.mark_cy = E.cy;
+			editorSetStatusMessage(E.mark_set ? "Mark set" : "Mark cleared");
+			break;
+		case CTRL_KEY('c'):
+			editorCopySelection();
+			break;
+		case CTRL_KEY('x'):
+			editorCutSelection();
+			break;
+		case CTRL_KEY('v'):
+			editorPaste(count);
+			break;
+		case CTRL_KEY('r'):
+			editorToggleRecording();
+			break;
+		case CTRL_KEY('e'):
+			editorCommandPrompt();
+			break;
+		case CTRL_KEY('y'):
+			editorWindowNext();
+			break;
+		case CTRL_KEY('a'):
+			editorPlayMacro(count);
 			break;
 		case CTRL_KEY('q'):
-			if (E.dirty && quit_times > 0){
-				editorSetStatusMessage("WARNING!!! File has unsaved changes! Press Ctrl-Q %d more times to quit.", quit_times);
+			if (editorBuffersDirty() && quit_times > 0){
+				if (E.nbufs > 1)
+					editorSetStatusMessage("WARNING!!! %d buffer(s) have unsaved changes! Press Ctrl-Q %d more times to quit.",
+						editorBuffersDirty(), quit_times);
+				else
+					editorSetStatusMessage("WARNING!!! File has unsaved changes! Press Ctrl-Q %d more times to quit.", quit_times);
 				quit_times--;
+				editorPhaseEnd(PH_INPUT, start);
 				return;
 			}
-			write(STDOUT_FILENO, "\x1b[2J", 4);
-			write(STDOUT_FILENO, "\x1b[H", 3);
+			write(E.outfd, "\x1b[2J", 4);
+			write(E.outfd, "\x1b[H", 3);
 			exit(0);
 			break;
 		case CTRL_KEY('s'):
@@ -1096,45 +6538,124 @@ void editorProcessKeypress(){
 		case CTRL_KEY('f'):
 			editorFind();
 			break;
+		case CTRL_KEY('o'):
+			editorJumpBracket();
+			break;
+		case CTRL_KEY('n'):
+			editorComplete();
+			break;
+		case CTRL_KEY('g'):
+			editorOutline();
+			break;
+		case CTRL_KEY('t'):
+			editorShowStats(STATS_GENERAL);
+			break;
+		case CTRL_KEY('p'):
+			E.perf_hud = !E.perf_hud;
+			break;
+		case CTRL_KEY('w'):
+			if (editorDumpHistograms(KILO_PERF_DUMP) == 0)
+				editorSetStatusMessage("Timing histograms written to %s", KILO_PERF_DUMP);
+			else
+				editorSetStatusMessage("Can't write %s: %s", KILO_PERF_DUMP, strerror(errno));
+			break;
 		//various deletion keys
 		case BACKSPACE:
 		case CTRL_KEY('h'):
 		case DEL_KEY:
-			if (c == DEL_KEY) editorMoveCursor(ARROW_RIGHT);
-			editorDelChar();
+			while (count--){
+				if (c == DEL_KEY) editorMoveCursor(ARROW_RIGHT);
+				editorDelChar();
+			}
 			break;
-		//Page up and down simulate arrow presses to scroll an entire page
+		//Page up and down go to the edge of the screen and then a page past it
 		case PAGE_UP:
 		case PAGE_DOWN:
-			{
-				if (c == PAGE_UP){
-					E.cy = E.rowoff;
-				}
-				else if (c == PAGE_DOWN){
-					E.cy = E.rowoff + E.screenrows - 1;
-					if (E.cy > E.numrows) E.cy = E.numrows;
-				}
-				int times = E.screenrows;
-				while (times--)
-					editorMoveCursor(c == PAGE_UP ? ARROW_UP : ARROW_DOWN);
-			}
+			editorPage(c, count);
 			break;
 
 		case ARROW_UP:
 		case ARROW_DOWN:
 		case ARROW_LEFT:
 		case ARROW_RIGHT:
-			editorMoveCursor(c);
+			while (count--) editorMoveCursor(c);
 			break;
-		case CTRL_KEY('l'):
 		case '\x1b':
+			E.mark_set = 0;
+			break;
+		case CTRL_KEY('l'):
 			break;
 		default:
-			editorInsertChar(c);
+			if (counted) editorInsertRepeated(c, count);
+			else if (c >= 0x80 && c < 256) editorInsertUtf8(c);
+			else editorInsertChar(c);
 			break;
 	}
 
 	quit_times = KILO_QUIT_TIMES;
+	editorPhaseEnd(PH_INPUT, start);
+}
+
+/*** MACROS ***/
+
+void editorMacroRecord(int c){
+	if (E.macro.len == E.macro.cap){
+		E.macro.cap = E.macro.cap ? E.macro.cap * 2 : 64;
+		E.macro.keys = memRealloc(E.macro.keys, sizeof(int) * E.macro.cap);
+	}
+	E.macro.keys[E.macro.len++] = c;
+}
+
+//If something (like a prompt) wants more keys than the macro has left, it
+//gets escape so it gives up instead of waiting
+int editorMacroNextKey(){
+	if (E.macro.pos >= E.macro.len) return '\x1b';
+	return E.macro.keys[E.macro.pos++];
+}
+
+void editorToggleRecording(){
+	if (E.macro_playing) return;
+	if (!E.macro_recording){
+		E.macro.len = 0;
+		E.macro_recording = 1;
+		editorSetStatusMessage("Recording macro, Ctrl-R to stop");
+		return;
+	}
+	E.macro_recording = 0;
+	//the Ctrl-R that stopped it got recorded too
+	if (E.macro.len > 0) E.macro.len--;
+	editorSetStatusMessage("Recorded %d key%s, Ctrl-A to play", E.macro.len,
+		E.macro.len == 1 ? "" : "s");
+}
+
+//Run the macro's keys through editorProcessKeypress count times over. Nothing
+//is drawn and no row is highlighted until it's all done, the cursor state is
+//kept the way a refresh would leave it so keys like page down still work
+void editorPlayMacro(int count){
+	if (E.macro_playing) return;
+	if (E.macro_recording){
+		editorSetStatusMessage("Can't play a macro while recording one");
+		return;
+	}
+	if (E.macro.len == 0){
+		editorSetStatusMessage("No macro recorded (Ctrl-R)");
+		return;
+	}
+	unsigned long long start = nowNanos();
+	E.macro_playing = 1;
+	E.stale_from = E.numrows;
+	for (int i = 0; i < count; i++){
+		E.macro.pos = 0;
+		while (E.macro.pos < E.macro.len){
+			editorProcessKeypress();
+			editorScroll();
+			if (E.cx < E.ln_length) E.cx = E.ln_length;
+		}
+	}
+	E.macro_playing = 0;
+	editorHighlightStale();
+	editorSetStatusMessage("Macro played %d time%s in %.1f ms", count, count == 1 ? "" : "s",
+		(nowNanos() - start) / 1e6);
 }
 
 /*** INIT ***/
@@ -1154,22 +6675,163 @@ void initEditor(){
 	E.statusmsg[0] = '\0';
 	E.statusmsg_time = 0;
 	E.syntax = NULL;
+	E.derived_bytes = 0;
+	E.derived_budget = KILO_DERIVED_BUDGET;
+	E.lru_hand = 0;
+	E.cache_hits = 0;
+	E.cache_misses = 0;
+	E.cache_evictions = 0;
+	E.stats_view = 0;
+	E.mark_set = 0;
+	E.reg.slices = NULL;
+	E.reg.count = 0;
+	E.cow_copies = 0;
+	E.macro.keys = NULL;
+	E.macro.len = 0;
+	E.macro.cap = 0;
+	E.macro.pos = 0;
+	E.macro_recording = 0;
+	E.macro_playing = 0;
+	E.stale_rows = 0;
+	E.stale_from = 0;
+	E.blocks = NULL;
+	E.nblocks = 0;
+	E.cold_blocks = 0;
+	E.offsets_from = 0;
+	E.br_tree = NULL;
+	E.br_size = 0;
+	E.br_stale = 1;
+	E.br_dirty = NULL;
+	E.br_ndirty = 0;
+	E.br_cap = 0;
+	E.br_hint = 0;
+	E.match_cy = -1;
+	E.match_rx = 0;
+	E.words.root = NULL;
+	E.words.words = 0;
+	E.words.nodes = 0;
+	E.words.bytes = 0;
+	E.comp.count = 0;
+	E.comp.active = 0;
+	E.outline = NULL;
+	E.outline_len = 0;
+	E.outline_cap = 0;
+	E.outline_pick = -1;
+	E.bufs = memCalloc(1, sizeof(struct editorBuffer));
+	E.nbufs = 1;
+	E.cur_buf = 0;
+	E.alt_buf = -1;
+	E.buf_clock = 0;
+	E.memory_budget = KILO_MEMORY_BUDGET;
+	E.buf_reloads = 0;
+	E.open_cache_hits = 0;
+	E.watch_fd = -1;
+	E.watch_wd = -1;
+	E.follow_fd = -1;
+	E.follow_off = 0;
+	E.follow_partial = 0;
+	E.follow_dirty = 0;
+	E.follow_more = 0;
+	E.redraw_pending = 0;
+	E.last_redraw = 0;
+	memset(&E.file_stat, 0, sizeof(E.file_stat));
+
+	memset(E.op_latency, 0, sizeof(E.op_latency));
+	memset(E.phase_latency, 0, sizeof(E.phase_latency));
+	E.last_frame_ns = 0;
+	E.last_frame_bytes = 0;
+	E.peak_frame_bytes = 0;
+	E.perf_hud = 0;
+	E.key_op = OP_OTHER;
+	E.key_context = 0;
+	E.key_start = 0;
 
 	if (getWindowSize(&E.screenrows, &E.screencols) == -1) die("getWindowSize");
 	//Make room for status bar
 	E.screenrows -= 2;
+	//one window to start with, taking up all of that
+	E.termrows = E.screenrows;
+	E.termcols = E.screencols;
+	E.win_root = memCalloc(1, sizeof(struct editorWindow));
+	E.win = E.win_root;
+	E.nwins = 1;
+	editorWindowsResize();
+	E.damage_from = 0;
+}
+
+//bench/kernels.c includes this file to call the row and highlight code directly
+#ifndef KILO_NO_MAIN
+
+/*** HEADLESS ***/
+
+//Latencies go to stdout when a replay finishes, however it finishes
+void editorReplayReport(){
+	editorLatencyReport(stdout);
+}
+
+//Run against a fake terminal of the given size, reading keys from a script
+//file instead of the keyboard. Frames go to framefile, or nowhere
+void editorStartHeadless(char *script, char *size, char *framefile){
+	E.headless = 1;
+	if (sscanf(size, "%dx%d", &E.screenrows, &E.screencols) != 2 ||
+		E.screenrows < 3 || E.screencols < 1){
+		fprintf(stderr, "kilo: bad terminal size '%s', expected ROWSxCOLS\n", size);
+		exit(1);
+	}
+	E.infd = open(script, O_RDONLY);
+	if (E.infd == -1) die(script);
+	E.outfd = open(framefile ? framefile : "/dev/null", O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (E.outfd == -1) die(framefile ? framefile : "/dev/null");
+	atexit(editorReplayReport);
+}
+
+void usage(){
+	fprintf(stderr, "usage: kilo [--replay SCRIPT [--size ROWSxCOLS] [--frames FILE]] [--follow] [file...]\n");
+	exit(1);
 }
 
 int main(int argc, char *argv[]){
-	enableRawMode();
+	char *filename = NULL;
+	//any files after the first are opened in buffers of their own
+	char *more[argc];
+	int nmore = 0;
+	char *script = NULL;
+	char *size = "24x80";
+	char *framefile = NULL;
+	int follow = 0;
+
+	E.infd = STDIN_FILENO;
+	E.outfd = STDOUT_FILENO;
+	for (int i = 1; i < argc; i++){
+		if (!strcmp(argv[i], "--replay") && i + 1 < argc) script = argv[++i];
+		else if (!strcmp(argv[i], "--size") && i + 1 < argc) size = argv[++i];
+		else if (!strcmp(argv[i], "--frames") && i + 1 < argc) framefile = argv[++i];
+		else if (!strcmp(argv[i], "--follow")) follow = 1;
+		else if (argv[i][0] == '-' && argv[i][1] == '-') usage();
+		else if (filename) more[nmore++] = argv[i];
+		else filename = argv[i];
+	}
+
+	if (script) editorStartHeadless(script, size, framefile);
+	else enableRawMode();
 	initEditor();
-	if (argc >= 2){
-		editorOpen(argv[1]);
+	if (filename){
+		unsigned long long start = nowNanos();
+		editorOpen(filename);
+		latencyRecord(&E.op_latency[OP_OPEN], nowNanos() - start);
 	}
+	//opening it only says something when it didn't go as expected, which
+	//beats the help
+	char said[sizeof(E.statusmsg)];
+	strcpy(said, E.statusmsg);
 	configureLNLength();
 	E.cx = E.ln_length;
+	for (int i = 0; i < nmore; i++) editorBufferOpen(more[i], 0);
+	if (nmore) editorBufferSwitch(0);
 
-	editorSetStatusMessage("HELP: Ctrl-S = save | Ctrl-Q = quit | Ctrl-F = find");
+	if (said[0]) editorSetStatusMessage("%s", said);
+	else editorSetStatusMessage("HELP: Ctrl-S = save | Ctrl-Q = quit | Ctrl-F = find | Ctrl-U n = repeat | Ctrl-K = del line | Ctrl-J = join | Ctrl-B/C/X/V = mark/copy/cut/paste");
+	if (follow && filename) editorToggleFollow();
 
 	while (1){
 		editorRefreshScreen();
@@ -1177,3 +6839,5 @@ int main(int argc, char *argv[]){
 	}
 	return 0;
 }
+
+#endif